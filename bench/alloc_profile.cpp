@@ -0,0 +1,557 @@
+/*
+ *  Allocation profile for the KDE4 libcompizconfig backend
+ *
+ *  Replaces malloc and friends for the whole process, runs full read and
+ *  write passes through the backend vtable in a throw-away KDEHOME and
+ *  reports allocations, allocated bytes and peak heap growth for each
+ *  vtable callback and, within readSetting and writeSetting, for each
+ *  setting type.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QDir>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <errno.h>
+
+extern "C"
+{
+#include <ccs.h>
+#include <ccs-backend.h>
+}
+
+#ifndef BACKEND_PATH
+#define BACKEND_PATH "libkconfig4.so"
+#endif
+
+/* glibc's own entry points, what our replacements forward to */
+extern "C"
+{
+void *__libc_malloc (size_t size);
+void *__libc_calloc (size_t nmemb, size_t size);
+void *__libc_realloc (void *ptr, size_t size);
+void *__libc_memalign (size_t alignment, size_t size);
+void *__libc_valloc (size_t size);
+void *__libc_pvalloc (size_t size);
+void __libc_free (void *ptr);
+}
+
+typedef CCSBackendVTable *(*GetBackendInfoProc) (void);
+
+typedef enum
+{
+    CallInit,
+    CallReadInit,
+    CallReadSetting,
+    CallReadDone,
+    CallWriteInit,
+    CallWriteSetting,
+    CallWriteDone,
+    CallFini,
+    N_CALLS
+}
+Callback;
+
+static const char *callbackNames[N_CALLS] =
+{
+    "init",
+    "readInit",
+    "readSetting",
+    "readDone",
+    "writeInit",
+    "writeSetting",
+    "writeDone",
+    "fini"
+};
+
+static const char *typeNames[TypeNum] =
+{
+    "bool",
+    "int",
+    "float",
+    "string",
+    "color",
+    "action",
+    "key",
+    "button",
+    "edge",
+    "bell",
+    "match",
+    "list"
+};
+
+/* slot 0 is a callback that is not about one setting, then one slot per
+   scalar type followed by one per list element type */
+#define N_SLOTS (1 + 2 * TypeNum)
+
+typedef struct _Bucket
+{
+    unsigned long      calls;
+    unsigned long      allocs;
+    unsigned long      frees;
+    unsigned long long bytes;
+    long long          peak;
+}
+Bucket;
+
+static Bucket buckets[N_CALLS][N_SLOTS];
+
+/* only the thread running a callback is profiled, and only while it does */
+static __thread Bucket *current = NULL;
+static long long       live;
+static long long       liveAtEntry;
+
+static inline void
+accountAlloc (void *ptr)
+{
+    Bucket *b = current;
+
+    if (!b || !ptr)
+	return;
+
+    size_t size = malloc_usable_size (ptr);
+
+    b->allocs++;
+    b->bytes += size;
+    live     += size;
+
+    if (live - liveAtEntry > b->peak)
+	b->peak = live - liveAtEntry;
+}
+
+static inline void
+accountFreed (size_t size)
+{
+    if (!current)
+	return;
+
+    current->frees++;
+    live -= size;
+}
+
+static inline void
+accountFree (void *ptr)
+{
+    if (ptr)
+	accountFreed (malloc_usable_size (ptr));
+}
+
+extern "C" void *
+malloc (size_t size)
+{
+    void *ptr = __libc_malloc (size);
+
+    accountAlloc (ptr);
+
+    return ptr;
+}
+
+extern "C" void *
+calloc (size_t nmemb,
+	size_t size)
+{
+    void *ptr = __libc_calloc (nmemb, size);
+
+    accountAlloc (ptr);
+
+    return ptr;
+}
+
+extern "C" void *
+realloc (void   *ptr,
+	 size_t size)
+{
+    /* a failed realloc keeps the old block, so it is only freed once
+       glibc returned a block or freed it for size 0; by then it may no
+       longer be looked at */
+    size_t old = (ptr) ? malloc_usable_size (ptr) : 0;
+    void   *moved = __libc_realloc (ptr, size);
+
+    if (ptr && (moved || !size))
+	accountFreed (old);
+
+    accountAlloc (moved);
+
+    return moved;
+}
+
+extern "C" void *
+memalign (size_t alignment,
+	  size_t size)
+{
+    void *ptr = __libc_memalign (alignment, size);
+
+    accountAlloc (ptr);
+
+    return ptr;
+}
+
+static inline bool
+isPowerOfTwo (size_t n)
+{
+    return n && !(n & (n - 1));
+}
+
+extern "C" void *
+aligned_alloc (size_t alignment,
+	       size_t size)
+{
+    if (!isPowerOfTwo (alignment))
+    {
+	errno = EINVAL;
+	return NULL;
+    }
+
+    void *ptr = __libc_memalign (alignment, size);
+
+    accountAlloc (ptr);
+
+    return ptr;
+}
+
+extern "C" void *
+valloc (size_t size)
+{
+    void *ptr = __libc_valloc (size);
+
+    accountAlloc (ptr);
+
+    return ptr;
+}
+
+extern "C" void *
+pvalloc (size_t size)
+{
+    void *ptr = __libc_pvalloc (size);
+
+    accountAlloc (ptr);
+
+    return ptr;
+}
+
+/* *ptr is left alone on errors, like glibc does */
+extern "C" int
+posix_memalign (void   **ptr,
+		size_t alignment,
+		size_t size)
+{
+    if (!isPowerOfTwo (alignment) || alignment % sizeof (void *))
+	return EINVAL;
+
+    void *mem = __libc_memalign (alignment, size);
+
+    if (!mem)
+	return ENOMEM;
+
+    accountAlloc (mem);
+    *ptr = mem;
+
+    return 0;
+}
+
+extern "C" void
+free (void *ptr)
+{
+    accountFree (ptr);
+    __libc_free (ptr);
+}
+
+static int
+settingSlot (CCSSetting *setting)
+{
+    if (!setting)
+	return 0;
+
+    if (setting->type == TypeList)
+	return 1 + TypeNum + setting->info.forList.listType;
+
+    return 1 + setting->type;
+}
+
+static void
+beginCall (Callback   call,
+	   CCSSetting *setting = NULL)
+{
+    Bucket *b = &buckets[call][settingSlot (setting)];
+
+    b->calls++;
+    liveAtEntry = live;
+    current     = b;
+}
+
+static void
+endCall ()
+{
+    current = NULL;
+}
+
+static QString
+slotName (int slot)
+{
+    if (slot == 0)
+	return QString ();
+
+    if (slot <= TypeNum)
+	return typeNames[slot - 1];
+
+    return QString ("list of ") + typeNames[slot - 1 - TypeNum];
+}
+
+static void
+removeTree (const QString &path)
+{
+    QDir dir (path);
+
+    foreach (const QFileInfo &info,
+	     dir.entryInfoList (QDir::AllEntries | QDir::NoDotAndDotDot |
+				QDir::Hidden | QDir::System))
+    {
+	if (info.isDir () && !info.isSymLink ())
+	    removeTree (info.filePath ());
+	else
+	    QFile::remove (info.filePath ());
+    }
+
+    dir.rmdir (path);
+}
+
+static void
+readPass (CCSBackendVTable *vTable,
+	  CCSContext       *context)
+{
+    beginCall (CallReadInit);
+    vTable->readInit (context);
+    endCall ();
+
+    for (CCSPluginList p = context->plugins; p; p = p->next)
+    {
+	for (CCSSettingList l = p->data->settings; l; l = l->next)
+	{
+	    beginCall (CallReadSetting, l->data);
+	    vTable->readSetting (context, l->data);
+	    endCall ();
+	}
+    }
+
+    if (vTable->readDone)
+    {
+	beginCall (CallReadDone);
+	vTable->readDone (context);
+	endCall ();
+    }
+}
+
+static void
+writePass (CCSBackendVTable *vTable,
+	   CCSContext       *context)
+{
+    beginCall (CallWriteInit);
+    vTable->writeInit (context);
+    endCall ();
+
+    for (CCSPluginList p = context->plugins; p; p = p->next)
+    {
+	for (CCSSettingList l = p->data->settings; l; l = l->next)
+	{
+	    beginCall (CallWriteSetting, l->data);
+	    vTable->writeSetting (context, l->data);
+	    endCall ();
+	}
+    }
+
+    if (vTable->writeDone)
+    {
+	beginCall (CallWriteDone);
+	vTable->writeDone (context);
+	endCall ();
+    }
+}
+
+static void
+printRow (const QString &name,
+	  const Bucket  &b)
+{
+    printf ("%-28s %8lu %10lu %8.1f %12llu %10.1f %10lld\n",
+	    name.toLocal8Bit ().constData (), b.calls, b.allocs,
+	    (double) b.allocs / b.calls, b.bytes, (double) b.bytes / b.calls,
+	    b.peak);
+}
+
+static void
+printHeader (const char *title)
+{
+    printf ("\n%-28s %8s %10s %8s %12s %10s %10s\n", title,
+	    "calls", "allocs", "/call", "bytes", "/call", "peak");
+}
+
+static void
+printReport (int passes)
+{
+    printf ("passes              %d read, %d write\n", passes, passes);
+
+    printHeader ("callback");
+
+    for (int call = 0; call < N_CALLS; call++)
+    {
+	Bucket total;
+
+	memset (&total, 0, sizeof (Bucket));
+
+	for (int slot = 0; slot < N_SLOTS; slot++)
+	{
+	    total.calls  += buckets[call][slot].calls;
+	    total.allocs += buckets[call][slot].allocs;
+	    total.frees  += buckets[call][slot].frees;
+	    total.bytes  += buckets[call][slot].bytes;
+	    total.peak    = qMax (total.peak, buckets[call][slot].peak);
+	}
+
+	if (total.calls)
+	    printRow (callbackNames[call], total);
+    }
+
+    const Callback perSetting[] = { CallReadSetting, CallWriteSetting };
+
+    for (unsigned int i = 0; i < sizeof (perSetting) / sizeof (Callback); i++)
+    {
+	printHeader (callbackNames[perSetting[i]]);
+
+	for (int slot = 1; slot < N_SLOTS; slot++)
+	{
+	    const Bucket &b = buckets[perSetting[i]][slot];
+
+	    if (b.calls)
+		printRow (slotName (slot), b);
+	}
+    }
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr,
+	     "usage: %s [-b backend] [-p passes] [-n]\n"
+	     "  -n  profile without KDE integration\n",
+	     name);
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    QString backend = BACKEND_PATH;
+    int     passes = 5;
+    bool    integration = true;
+    int     opt;
+
+    while ((opt = getopt (argc, argv, "b:p:nh")) != -1)
+    {
+	switch (opt)
+	{
+	case 'b':
+	    backend = optarg;
+	    break;
+	case 'p':
+	    passes = atoi (optarg);
+	    break;
+	case 'n':
+	    integration = false;
+	    break;
+	default:
+	    usage (argv[0]);
+	    return 1;
+	}
+    }
+
+    if (passes <= 0)
+    {
+	usage (argv[0]);
+	return 1;
+    }
+
+    char home[] = "/tmp/alloc-profile-XXXXXX";
+
+    if (!mkdtemp (home))
+    {
+	perror ("mkdtemp");
+	return 1;
+    }
+
+    QDir ().mkpath (QString (home) + "/share/config/");
+    setenv ("KDEHOME", home, 1);
+
+    QCoreApplication app (argc, argv);
+
+    void *dlhand = dlopen (QFile::encodeName (backend).constData (),
+			   RTLD_NOW | RTLD_LOCAL);
+
+    if (!dlhand)
+    {
+	fprintf (stderr, "%s\n", dlerror ());
+	removeTree (home);
+	return 1;
+    }
+
+    GetBackendInfoProc getInfo = (GetBackendInfoProc)
+	dlsym (dlhand, "getBackendInfo");
+
+    if (!getInfo)
+    {
+	fprintf (stderr, "%s is not a compizconfig backend\n",
+		 backend.toLocal8Bit ().constData ());
+	dlclose (dlhand);
+	removeTree (home);
+	return 1;
+    }
+
+    CCSBackendVTable *vTable  = getInfo ();
+    CCSContext       *context = ccsEmptyContextNew (0);
+
+    ccsLoadPlugins (context);
+    ccsSetIntegrationEnabled (context, (integration) ? TRUE : FALSE);
+
+    beginCall (CallInit);
+    vTable->init (context);
+    endCall ();
+
+    /* the first pass creates the files, every later one rewrites them */
+    for (int i = 0; i < passes; i++)
+    {
+	writePass (vTable, context);
+	readPass (vTable, context);
+    }
+
+    beginCall (CallFini);
+    vTable->fini (context);
+    endCall ();
+
+    printReport (passes);
+
+    ccsContextDestroy (context);
+    dlclose (dlhand);
+
+    removeTree (home);
+
+    return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ *  Load time benchmark for the KDE4 libcompizconfig backend
+ *
+ *  Times loading the backend the way libcompizconfig does, dlopen (),
+ *  dlsym () of getBackendInfo () and calling it, over a number of load
+ *  and unload cycles, then times the getSettingIsIntegrated () and
+ *  getSettingIsReadOnly () queries over the settings of all plugins,
+ *  which look every setting up in the backend's integrated option table.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QList>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+
+extern "C"
+{
+#include <ccs.h>
+#include <ccs-backend.h>
+}
+
+#ifndef BACKEND_PATH
+#define BACKEND_PATH "libkconfig4.so"
+#endif
+
+typedef CCSBackendVTable *(*GetBackendInfoProc) (void);
+
+typedef struct _Options
+{
+    QString backend;
+    int     cycles;	/* dlopen/dlclose pairs */
+    int     passes;	/* query passes over all settings */
+}
+Options;
+
+typedef struct _Cycle
+{
+    quint64 open;
+    quint64 info;
+}
+Cycle;
+
+static quint64
+timeUsec ()
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+
+    return (quint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* one dlopen (), dlsym () and getBackendInfo (), the way
+   libcompizconfig loads a backend */
+static bool
+loadCycle (const Options &options,
+	   Cycle         &cycle)
+{
+    quint64 start  = timeUsec ();
+    void    *dlhand = dlopen (QFile::encodeName (options.backend).constData (),
+			      RTLD_NOW | RTLD_LOCAL);
+
+    if (!dlhand)
+    {
+	fprintf (stderr, "%s\n", dlerror ());
+	return false;
+    }
+
+    quint64            opened  = timeUsec ();
+    GetBackendInfoProc getInfo = (GetBackendInfoProc)
+	dlsym (dlhand, "getBackendInfo");
+
+    if (!getInfo || !getInfo ())
+    {
+	fprintf (stderr, "%s is not a compizconfig backend\n",
+		 options.backend.toLocal8Bit ().constData ());
+	dlclose (dlhand);
+	return false;
+    }
+
+    cycle.open = opened - start;
+    cycle.info = timeUsec () - opened;
+
+    dlclose (dlhand);
+
+    return true;
+}
+
+/* queries per second, and how many settings are integrated */
+static double
+queryPasses (CCSBackendVTable *vTable,
+	     CCSContext       *context,
+	     int              passes,
+	     unsigned int     *integrated)
+{
+    unsigned long long queries = 0;
+    quint64            start   = timeUsec ();
+
+    for (int i = 0; i < passes; i++)
+    {
+	*integrated = 0;
+
+	for (CCSPluginList p = context->plugins; p; p = p->next)
+	{
+	    for (CCSSettingList l = p->data->settings; l; l = l->next)
+	    {
+		if (vTable->getSettingIsIntegrated (l->data))
+		    (*integrated)++;
+
+		vTable->getSettingIsReadOnly (l->data);
+		queries += 2;
+	    }
+	}
+    }
+
+    return queries * 1000000.0 / qMax ((quint64) 1, timeUsec () - start);
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr, "usage: %s [-b backend] [-c cycles] [-p passes]\n",
+	     name);
+}
+
+static bool
+parseOptions (int     argc,
+	      char    **argv,
+	      Options *options)
+{
+    int opt;
+
+    options->backend = BACKEND_PATH;
+    options->cycles  = 20;
+    options->passes  = 1000;
+
+    while ((opt = getopt (argc, argv, "b:c:p:h")) != -1)
+    {
+	switch (opt)
+	{
+	case 'b':
+	    options->backend = optarg;
+	    break;
+	case 'c':
+	    options->cycles = atoi (optarg);
+	    break;
+	case 'p':
+	    options->passes = atoi (optarg);
+	    break;
+	default:
+	    return false;
+	}
+    }
+
+    return options->cycles > 0 && options->passes > 0;
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    Options options;
+
+    if (!parseOptions (argc, argv, &options))
+    {
+	usage (argv[0]);
+	return 1;
+    }
+
+    QCoreApplication app (argc, argv);
+    QList<Cycle>     cycles;
+    Cycle            cycle;
+
+    for (int i = 0; i < options.cycles; i++)
+    {
+	if (!loadCycle (options, cycle))
+	    return 1;
+
+	cycles.append (cycle);
+    }
+
+    /* the first cycle pays for relocating the backend's dependencies,
+       later ones only for what the backend does itself */
+    Cycle rest = { 0, 0 };
+
+    for (int i = 1; i < cycles.size (); i++)
+    {
+	rest.open += cycles[i].open;
+	rest.info += cycles[i].info;
+    }
+
+    int n = qMax (1, cycles.size () - 1);
+
+    printf ("cycles              %d\n", options.cycles);
+    printf ("first load          %llu us dlopen, %llu us getBackendInfo\n",
+	    (unsigned long long) cycles[0].open,
+	    (unsigned long long) cycles[0].info);
+    printf ("later loads         %.1f us dlopen, %.1f us getBackendInfo\n",
+	    (double) rest.open / n, (double) rest.info / n);
+
+    void *dlhand = dlopen (QFile::encodeName (options.backend).constData (),
+			   RTLD_NOW | RTLD_LOCAL);
+
+    if (!dlhand)
+    {
+	fprintf (stderr, "%s\n", dlerror ());
+	return 1;
+    }
+
+    GetBackendInfoProc getInfo = (GetBackendInfoProc)
+	dlsym (dlhand, "getBackendInfo");
+    CCSBackendVTable   *vTable  = getInfo ();
+    CCSContext         *context = ccsEmptyContextNew (0);
+    unsigned int       settings = 0;
+    unsigned int       integrated;
+
+    ccsLoadPlugins (context);
+    ccsSetIntegrationEnabled (context, TRUE);
+
+    for (CCSPluginList p = context->plugins; p; p = p->next)
+	settings += ccsSettingListLength (p->data->settings);
+
+    double rate = queryPasses (vTable, context, options.passes, &integrated);
+
+    printf ("settings            %u, %u integrated\n", settings, integrated);
+    printf ("queries             %.0f per second\n", rate);
+
+    ccsContextDestroy (context);
+    dlclose (dlhand);
+
+    return 0;
+}
@@ -0,0 +1,366 @@
+/*
+ *  Binding cache benchmark for the KDE4 libcompizconfig backend
+ *
+ *  Builds a profile of many key and button bindings, drawn from a pool
+ *  of distinct strings the way real profiles repeat "Disabled" and a few
+ *  common modifiers, and times read and write passes over it through
+ *  libcompizconfig's conversions directly and through the backend's
+ *  per-pass binding cache.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QByteArray>
+#include <QList>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+
+extern "C"
+{
+#include <ccs.h>
+}
+
+#include "binding_cache.h"
+
+static quint64
+timeUsec ()
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+
+    return (quint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static const char *modifiers[] =
+{
+    "", "<Control>", "<Alt>", "<Super>", "<Shift><Control>",
+    "<Control><Alt>", "<Shift><Super>", "<Control><Super>"
+};
+
+static const char *keys[] =
+{
+    "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+    "n", "o", "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z",
+    "1", "2", "3", "4", "5", "6", "7", "8", "9", "0",
+    "F1", "F2", "F3", "F4", "F5", "F6", "F7", "F8", "F9", "F10", "F11",
+    "F12", "Left", "Right", "Up", "Down", "Home", "End", "Tab", "space"
+};
+
+#define N_TOKENS(t) (sizeof (t) / sizeof (t[0]))
+
+typedef struct _Options
+{
+    int bindings;	/* per type */
+    int distinct;	/* strings per type */
+    int disabled;	/* percentage of "Disabled" bindings */
+    int passes;
+}
+Options;
+
+typedef struct _Profile
+{
+    QList<QByteArray> keys;
+    QList<QByteArray> buttons;
+}
+Profile;
+
+/* the distinct strings are a prefix of all modifier/key combinations, so
+   they stay valid bindings for any pool size */
+static QByteArray
+keyString (int i)
+{
+    return QByteArray (modifiers[i % N_TOKENS (modifiers)]) +
+	   keys[(i / N_TOKENS (modifiers)) % N_TOKENS (keys)];
+}
+
+static QByteArray
+buttonString (int i)
+{
+    return QByteArray (modifiers[i % N_TOKENS (modifiers)]) + "Button" +
+	   QByteArray::number (1 + (i / (int) N_TOKENS (modifiers)) % 9);
+}
+
+static void
+buildProfile (const Options &options,
+	      Profile       &profile)
+{
+    for (int i = 0; i < options.bindings; i++)
+    {
+	if (rand () % 100 < options.disabled)
+	{
+	    profile.keys.append ("Disabled");
+	    profile.buttons.append ("Disabled");
+	    continue;
+	}
+
+	profile.keys.append (keyString (rand () % options.distinct));
+	profile.buttons.append (buttonString (rand () % options.distinct));
+    }
+}
+
+typedef struct _Pass
+{
+    quint64      time;
+    unsigned int hits;
+    unsigned int misses;
+    unsigned int invalid;
+}
+Pass;
+
+static void
+readDirect (const Profile             &profile,
+	    QList<CCSSettingKeyValue>    &keyValues,
+	    QList<CCSSettingButtonValue> &buttonValues,
+	    Pass                         &pass)
+{
+    quint64 start = timeUsec ();
+
+    keyValues.clear ();
+    buttonValues.clear ();
+
+    foreach (const QByteArray &str, profile.keys)
+    {
+	CCSSettingKeyValue value;
+
+	memset (&value, 0, sizeof (value));
+	if (!ccsStringToKeyBinding (str.constData (), &value))
+	    pass.invalid++;
+	keyValues.append (value);
+    }
+
+    foreach (const QByteArray &str, profile.buttons)
+    {
+	CCSSettingButtonValue value;
+
+	memset (&value, 0, sizeof (value));
+	if (!ccsStringToButtonBinding (str.constData (), &value))
+	    pass.invalid++;
+	buttonValues.append (value);
+    }
+
+    pass.time += timeUsec () - start;
+}
+
+/* like a read pass of the backend, which starts with an empty cache */
+static void
+readCached (const Profile             &profile,
+	    QList<CCSSettingKeyValue>    &keyValues,
+	    QList<CCSSettingButtonValue> &buttonValues,
+	    Pass                         &pass)
+{
+    quint64 start = timeUsec ();
+
+    resetBindingCache (NULL);
+    keyValues.clear ();
+    buttonValues.clear ();
+
+    foreach (const QByteArray &str, profile.keys)
+    {
+	CCSSettingKeyValue value;
+
+	memset (&value, 0, sizeof (value));
+	if (!cachedStringToKeyBinding (str, &value))
+	    pass.invalid++;
+	keyValues.append (value);
+    }
+
+    foreach (const QByteArray &str, profile.buttons)
+    {
+	CCSSettingButtonValue value;
+
+	memset (&value, 0, sizeof (value));
+	if (!cachedStringToButtonBinding (str, &value))
+	    pass.invalid++;
+	buttonValues.append (value);
+    }
+
+    pass.time   += timeUsec () - start;
+    pass.hits   += bindingCache ().hits;
+    pass.misses += bindingCache ().misses;
+}
+
+static void
+writeDirect (QList<CCSSettingKeyValue>    &keyValues,
+	     QList<CCSSettingButtonValue> &buttonValues,
+	     QList<QByteArray>            &out,
+	     Pass                         &pass)
+{
+    quint64 start = timeUsec ();
+
+    out.clear ();
+
+    for (int i = 0; i < keyValues.size (); i++)
+    {
+	char *val = ccsKeyBindingToString (&keyValues[i]);
+
+	out.append (val);
+	free (val);
+    }
+
+    for (int i = 0; i < buttonValues.size (); i++)
+    {
+	char *val = ccsButtonBindingToString (&buttonValues[i]);
+
+	out.append (val);
+	free (val);
+    }
+
+    pass.time += timeUsec () - start;
+}
+
+/* the strings are kept across write passes, so only the first misses */
+static void
+writeCached (QList<CCSSettingKeyValue>    &keyValues,
+	     QList<CCSSettingButtonValue> &buttonValues,
+	     QList<QByteArray>            &out,
+	     Pass                         &pass)
+{
+    quint64 start = timeUsec ();
+
+    bindingCache ().hits   = 0;
+    bindingCache ().misses = 0;
+    out.clear ();
+
+    for (int i = 0; i < keyValues.size (); i++)
+	out.append (cachedKeyBindingToString (&keyValues[i]));
+
+    for (int i = 0; i < buttonValues.size (); i++)
+	out.append (cachedButtonBindingToString (&buttonValues[i]));
+
+    pass.time   += timeUsec () - start;
+    pass.hits   += bindingCache ().hits;
+    pass.misses += bindingCache ().misses;
+}
+
+static void
+printPass (const char    *name,
+	   const Pass    &direct,
+	   const Pass    &cached,
+	   const Options &options)
+{
+    printf ("%-19s %.1f us direct, %.1f us cached, %.2fx\n", name,
+	    (double) direct.time / options.passes,
+	    (double) cached.time / options.passes,
+	    (cached.time) ? (double) direct.time / cached.time : 0.0);
+    printf ("%-19s %u hits, %u misses per pass\n", "",
+	    cached.hits / options.passes, cached.misses / options.passes);
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr, "usage: %s [-n bindings] [-d distinct] "
+	     "[-x disabled %%] [-p passes] [-s seed]\n", name);
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    Options      options;
+    unsigned int seed = time (NULL);
+    int          opt;
+
+    options.bindings = 5000;
+    options.distinct = 200;
+    options.disabled = 60;
+    options.passes   = 50;
+
+    while ((opt = getopt (argc, argv, "n:d:x:p:s:h")) != -1)
+    {
+	switch (opt)
+	{
+	case 'n':
+	    options.bindings = atoi (optarg);
+	    break;
+	case 'd':
+	    options.distinct = atoi (optarg);
+	    break;
+	case 'x':
+	    options.disabled = atoi (optarg);
+	    break;
+	case 'p':
+	    options.passes = atoi (optarg);
+	    break;
+	case 's':
+	    seed = strtoul (optarg, NULL, 10);
+	    break;
+	default:
+	    usage (argv[0]);
+	    return 1;
+	}
+    }
+
+    if (options.bindings <= 0 || options.distinct <= 0 ||
+	options.passes <= 0)
+    {
+	usage (argv[0]);
+	return 1;
+    }
+
+    srand (seed);
+
+    Profile profile;
+
+    buildProfile (options, profile);
+
+    QList<CCSSettingKeyValue>    directKeys, cachedKeys;
+    QList<CCSSettingButtonValue> directButtons, cachedButtons;
+    QList<QByteArray>            directOut, cachedOut;
+    Pass                         readD, readC, writeD, writeC;
+
+    memset (&readD, 0, sizeof (Pass));
+    memset (&readC, 0, sizeof (Pass));
+    memset (&writeD, 0, sizeof (Pass));
+    memset (&writeC, 0, sizeof (Pass));
+
+    for (int i = 0; i < options.passes; i++)
+    {
+	readDirect (profile, directKeys, directButtons, readD);
+	readCached (profile, cachedKeys, cachedButtons, readC);
+	writeDirect (directKeys, directButtons, directOut, writeD);
+	writeCached (cachedKeys, cachedButtons, cachedOut, writeC);
+    }
+
+    /* the cache may not change a single conversion */
+    bool same = directOut == cachedOut && readD.invalid == readC.invalid;
+
+    for (int i = 0; same && i < directKeys.size (); i++)
+	same = !memcmp (&directKeys[i], &cachedKeys[i],
+			sizeof (CCSSettingKeyValue));
+
+    for (int i = 0; same && i < directButtons.size (); i++)
+	same = !memcmp (&directButtons[i], &cachedButtons[i],
+			sizeof (CCSSettingButtonValue));
+
+    printf ("seed                %u\n", seed);
+    printf ("bindings            %d keys, %d buttons, %d%% disabled\n",
+	    options.bindings, options.bindings, options.disabled);
+    printf ("distinct strings    %d per type, cache size %d\n",
+	    options.distinct, BINDING_CACHE_SIZE);
+    printf ("passes              %d\n", options.passes);
+    printPass ("read pass", readD, readC, options);
+    printPass ("write pass", writeD, writeC, options);
+    printf ("results             %s\n", (same) ? "identical" : "DIFFERENT");
+
+    return (same) ? 0 : 1;
+}
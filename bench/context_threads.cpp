@@ -0,0 +1,404 @@
+/*
+ *  Multi-context benchmark for the KDE4 libcompizconfig backend
+ *
+ *  Loads the backend into a throw-away KDEHOME and gives every thread a
+ *  CCSContext of its own, which the thread initializes with the backend,
+ *  runs read passes and every few of them a write pass over all its
+ *  settings for a while, and finishes again, first one thread alone, then
+ *  all at once. Reports how init, read and write rates scale with the
+ *  number of threads; the contexts share the default profile and the
+ *  backend's process wide state, the locks around KGlobal::dirs () and
+ *  the file watches included.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QDir>
+#include <QThread>
+#include <QStringList>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+
+extern "C"
+{
+#include <ccs.h>
+#include <ccs-backend.h>
+}
+
+#ifndef BACKEND_PATH
+#define BACKEND_PATH "libkconfig4.so"
+#endif
+
+typedef CCSBackendVTable *(*GetBackendInfoProc) (void);
+
+typedef struct _Options
+{
+    QString backend;
+    int     duration;	/* seconds per run */
+    int     threads;	/* contexts, one thread each */
+    int     writeEvery;	/* read passes per write pass */
+    bool    integration;
+}
+Options;
+
+typedef struct _Result
+{
+    quint64            initTime;	/* init () and fini () */
+    quint64            readTime;
+    quint64            writeTime;
+    unsigned long long reads;	/* settings */
+    unsigned long long writes;
+}
+Result;
+
+static quint64
+timeUsec ()
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+
+    return (quint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* ccsProcessEvents () is left out, it must not run while other threads
+   init or fini their contexts, see fileWatchLock () in the backend */
+class Worker : public QThread
+{
+    public:
+	Worker (CCSBackendVTable *vTable,
+		CCSContext       *context,
+		int              writeEvery) :
+	    mVTable (vTable),
+	    mContext (context),
+	    mWriteEvery (writeEvery),
+	    mStop (false)
+	{
+	    memset (&mResult, 0, sizeof (Result));
+	}
+
+	void stop ()
+	{
+	    mStop = true;
+	}
+
+	const Result & result () const
+	{
+	    return mResult;
+	}
+
+    protected:
+	void run ()
+	{
+	    quint64 start = timeUsec ();
+
+	    mVTable->init (mContext);
+	    mResult.initTime += timeUsec () - start;
+
+	    for (int pass = 1; !mStop; pass++)
+	    {
+		start = timeUsec ();
+		readPass ();
+		mResult.readTime += timeUsec () - start;
+
+		if (pass % mWriteEvery)
+		    continue;
+
+		start = timeUsec ();
+		writePass ();
+		mResult.writeTime += timeUsec () - start;
+	    }
+
+	    start = timeUsec ();
+	    mVTable->fini (mContext);
+	    mResult.initTime += timeUsec () - start;
+	}
+
+    private:
+	void readPass ()
+	{
+	    if (mVTable->readInit && !mVTable->readInit (mContext))
+		return;
+
+	    for (CCSPluginList p = mContext->plugins; p; p = p->next)
+	    {
+		for (CCSSettingList l = p->data->settings; l; l = l->next)
+		{
+		    mVTable->readSetting (mContext, l->data);
+		    mResult.reads++;
+		}
+	    }
+
+	    if (mVTable->readDone)
+		mVTable->readDone (mContext);
+	}
+
+	/* every setting, as if all of them had changed */
+	void writePass ()
+	{
+	    if (mVTable->writeInit && !mVTable->writeInit (mContext))
+		return;
+
+	    for (CCSPluginList p = mContext->plugins; p; p = p->next)
+	    {
+		for (CCSSettingList l = p->data->settings; l; l = l->next)
+		{
+		    mVTable->writeSetting (mContext, l->data);
+		    mResult.writes++;
+		}
+	    }
+
+	    if (mVTable->writeDone)
+		mVTable->writeDone (mContext);
+	}
+
+	CCSBackendVTable *mVTable;
+	CCSContext       *mContext;
+	int              mWriteEvery;
+	volatile bool    mStop;
+	Result           mResult;
+};
+
+/* the summed results of the given contexts, each on a thread of its own;
+   the times are per thread, the counts of all of them */
+static void
+run (CCSBackendVTable          *vTable,
+     const QList<CCSContext *> &contexts,
+     const Options             &options,
+     Result                    &result)
+{
+    QList<Worker *> workers;
+
+    memset (&result, 0, sizeof (Result));
+
+    foreach (CCSContext *context, contexts)
+	workers.append (new Worker (vTable, context, options.writeEvery));
+
+    foreach (Worker *worker, workers)
+	worker->start ();
+
+    ::sleep (options.duration);
+
+    foreach (Worker *worker, workers)
+	worker->stop ();
+
+    foreach (Worker *worker, workers)
+    {
+	worker->wait ();
+
+	const Result &r = worker->result ();
+
+	result.initTime  += r.initTime;
+	result.readTime  += r.readTime;
+	result.writeTime += r.writeTime;
+	result.reads     += r.reads;
+	result.writes    += r.writes;
+
+	delete worker;
+    }
+
+    result.initTime  /= contexts.size ();
+    result.readTime  /= contexts.size ();
+    result.writeTime /= contexts.size ();
+}
+
+static double
+rate (unsigned long long count,
+      quint64            time)
+{
+    return (time) ? count * 1000000.0 / time : 0.0;
+}
+
+static void
+printResult (const char   *name,
+	     const Result &result)
+{
+    printf ("%-19s %.1f ms init and fini per context\n", name,
+	    result.initTime / 1000.0);
+    printf ("%-19s %.0f reads/s, %.0f writes/s\n", "",
+	    rate (result.reads, result.readTime),
+	    rate (result.writes, result.writeTime));
+}
+
+static void
+removeTree (const QString &path)
+{
+    QDir dir (path);
+
+    foreach (const QFileInfo &info,
+	     dir.entryInfoList (QDir::AllEntries | QDir::NoDotAndDotDot |
+				QDir::Hidden | QDir::System))
+    {
+	if (info.isDir () && !info.isSymLink ())
+	    removeTree (info.filePath ());
+	else
+	    QFile::remove (info.filePath ());
+    }
+
+    dir.rmdir (path);
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr, "usage: %s [-b backend] [-d seconds] [-t threads] "
+	     "[-w reads per write] [-n]\n", name);
+}
+
+static bool
+parseOptions (int     argc,
+	      char    **argv,
+	      Options *options)
+{
+    int opt;
+
+    options->backend     = BACKEND_PATH;
+    options->duration    = 5;
+    options->threads     = QThread::idealThreadCount ();
+    options->writeEvery  = 4;
+    options->integration = true;
+
+    while ((opt = getopt (argc, argv, "b:d:t:w:nh")) != -1)
+    {
+	switch (opt)
+	{
+	case 'b':
+	    options->backend = optarg;
+	    break;
+	case 'd':
+	    options->duration = atoi (optarg);
+	    break;
+	case 't':
+	    options->threads = atoi (optarg);
+	    break;
+	case 'w':
+	    options->writeEvery = atoi (optarg);
+	    break;
+	case 'n':
+	    options->integration = false;
+	    break;
+	default:
+	    return false;
+	}
+    }
+
+    return options->duration > 0 && options->threads > 0 &&
+	   options->writeEvery > 0;
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    Options options;
+
+    if (!parseOptions (argc, argv, &options))
+    {
+	usage (argv[0]);
+	return 1;
+    }
+
+    char home[] = "/tmp/context-threads-XXXXXX";
+
+    if (!mkdtemp (home))
+    {
+	perror ("mkdtemp");
+	return 1;
+    }
+
+    QDir ().mkpath (QString (home) + "/share/config");
+    setenv ("KDEHOME", home, 1);
+
+    QCoreApplication app (argc, argv);
+
+    void *dlhand = dlopen (QFile::encodeName (options.backend).constData (),
+			   RTLD_NOW | RTLD_LOCAL);
+
+    if (!dlhand)
+    {
+	fprintf (stderr, "%s\n", dlerror ());
+	removeTree (home);
+	return 1;
+    }
+
+    GetBackendInfoProc getInfo = (GetBackendInfoProc)
+	dlsym (dlhand, "getBackendInfo");
+
+    if (!getInfo)
+    {
+	fprintf (stderr, "%s is not a compizconfig backend\n",
+		 options.backend.toLocal8Bit ().constData ());
+	dlclose (dlhand);
+	removeTree (home);
+	return 1;
+    }
+
+    CCSBackendVTable    *vTable = getInfo ();
+    QList<CCSContext *> contexts;
+    unsigned int        settings = 0;
+
+    /* init, the passes and fini all run on the context's thread */
+    for (int i = 0; i < options.threads; i++)
+    {
+	CCSContext *context = ccsEmptyContextNew (0);
+
+	ccsLoadPlugins (context);
+	ccsSetIntegrationEnabled (context, options.integration);
+
+	for (CCSPluginList p = context->plugins; p; p = p->next)
+	    settings += ccsSettingListLength (p->data->settings);
+
+	contexts.append (context);
+    }
+
+    Result single, all;
+
+    run (vTable, contexts.mid (0, 1), options, single);
+    run (vTable, contexts, options, all);
+
+    printf ("duration            %d s per run\n", options.duration);
+    printf ("integration         %s\n", (options.integration) ? "on" : "off");
+    printf ("settings            %u per context\n",
+	    settings / options.threads);
+    printf ("write pass          every %d read passes\n", options.writeEvery);
+    printResult ("1 thread", single);
+
+    char name[32];
+
+    snprintf (name, sizeof (name), "%d threads", options.threads);
+    printResult (name, all);
+    printf ("%-19s %.2f reads, %.2f writes per thread of 1\n", "",
+	    rate (all.reads, all.readTime) /
+	    rate (single.reads, single.readTime) / options.threads,
+	    (single.writes) ? rate (all.writes, all.writeTime) /
+	    rate (single.writes, single.writeTime) / options.threads : 0.0);
+
+    foreach (CCSContext *context, contexts)
+	ccsContextDestroy (context);
+
+    dlclose (dlhand);
+
+    removeTree (home);
+
+    return 0;
+}
@@ -0,0 +1,565 @@
+/*
+ *  Reload storm benchmark for the KDE4 libcompizconfig backend
+ *
+ *  Loads the backend into a throw-away KDEHOME, lets editor threads
+ *  rewrite compizrc, kwinrc and kglobalshortcutsrc at a fixed rate while
+ *  the main thread dispatches file watch events and writes settings
+ *  itself, and reports how much reloading that caused. Once the editors
+ *  stop, every file gets one last change that the backend has to pick
+ *  up from its file watch alone.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QDir>
+#include <QThread>
+#include <QStringList>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+
+extern "C"
+{
+#include <ccs.h>
+#include <ccs-backend.h>
+}
+
+#ifndef BACKEND_PATH
+#define BACKEND_PATH "libkconfig4.so"
+#endif
+
+typedef CCSBackendVTable *(*GetBackendInfoProc) (void);
+typedef void (*GetBackendReloadStatsProc) (CCSContext         *context,
+					   unsigned int       *reloads,
+					   unsigned int       *skipped,
+					   unsigned long long *usec);
+
+typedef enum
+{
+    EditMain,
+    EditKwin,
+    EditShortcuts,
+    N_EDITS
+}
+EditTarget;
+
+static const char *editFiles[N_EDITS] =
+{
+    "compizrc",
+    "kwinrc",
+    "kglobalshortcutsrc"
+};
+
+typedef struct _Options
+{
+    QString      backend;
+    int          duration;	/* seconds */
+    int          rate;		/* external writes per second and file */
+    int          size;		/* bytes per written file */
+    int          noop;		/* percentage of unchanged rewrites */
+    int          ownRate;	/* writeDone passes per second */
+    bool         edit[N_EDITS];
+}
+Options;
+
+static quint64
+timeUsec ()
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+
+    return (quint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static QByteArray
+fileContent (EditTarget target,
+	     int        generation,
+	     int        size)
+{
+    QByteArray data;
+    bool       odd = generation & 1;
+
+    switch (target)
+    {
+    case EditMain:
+	data += "[core_display]\n";
+	data += (odd) ? "audible_bell=true\n" : "audible_bell=false\n";
+	break;
+    case EditKwin:
+	data += "[Windows]\n";
+	data += (odd) ? "FocusPolicy=FocusFollowsMouse\n" :
+			"FocusPolicy=ClickToFocus\n";
+	data += (odd) ? "ElectricBorders=1\n" : "ElectricBorders=0\n";
+	data += "BorderSnapZone=" + QByteArray::number (generation % 32) + "\n";
+	break;
+    case EditShortcuts:
+	data += "[kwin]\n";
+	data += (odd) ? "Window Close=Alt+F5,Alt+F4,Close Window\n" :
+			"Window Close=Alt+F4,Alt+F4,Close Window\n";
+	break;
+    default:
+	break;
+    }
+
+    /* groups nobody reads, like the rest of a real kwinrc */
+    for (int group = 0; data.size () < size; group++)
+    {
+	data += "\n[Filler " + QByteArray::number (group) + "]\n";
+
+	for (int key = 0; key < 8; key++)
+	    data += "Key" + QByteArray::number (key) + "=" +
+		    QByteArray (24, 'a' + (key % 26)) + "\n";
+    }
+
+    return data;
+}
+
+static void
+writeFile (const QString    &path,
+	   const QByteArray &data)
+{
+    QFile f (path);
+
+    /* rewritten in place, like most editors and config tools do */
+    if (f.open (QIODevice::WriteOnly | QIODevice::Truncate))
+	f.write (data);
+}
+
+class Editor : public QThread
+{
+    public:
+	Editor (const QString &path,
+		EditTarget    target,
+		const Options &options) :
+	    mPath (path),
+	    mTarget (target),
+	    mOptions (options),
+	    mStop (false),
+	    mWrites (0),
+	    mGeneration (0)
+	{
+	}
+
+	void stop ()
+	{
+	    mStop = true;
+	}
+
+	unsigned int writes () const
+	{
+	    return mWrites;
+	}
+
+	/* once stopped, one more write that differs from all before */
+	int finish ()
+	{
+	    mGeneration++;
+	    writeFile (mPath, fileContent (mTarget, mGeneration, mOptions.size));
+	    mWrites++;
+
+	    return mGeneration;
+	}
+
+    protected:
+	void run ()
+	{
+	    while (!mStop)
+	    {
+		if ((rand () % 100) >= mOptions.noop)
+		    mGeneration++;
+
+		writeFile (mPath, fileContent (mTarget, mGeneration,
+					       mOptions.size));
+		mWrites++;
+
+		::usleep (1000000 / mOptions.rate);
+	    }
+	}
+
+    private:
+	QString       mPath;
+	EditTarget    mTarget;
+	Options       mOptions;
+	volatile bool mStop;
+	unsigned int  mWrites;
+	int           mGeneration;
+};
+
+static void
+removeTree (const QString &path)
+{
+    QDir dir (path);
+
+    foreach (const QFileInfo &info,
+	     dir.entryInfoList (QDir::AllEntries | QDir::NoDotAndDotDot |
+				QDir::Hidden | QDir::System))
+    {
+	if (info.isDir () && !info.isSymLink ())
+	    removeTree (info.filePath ());
+	else
+	    QFile::remove (info.filePath ());
+    }
+
+    dir.rmdir (path);
+}
+
+static CCSSetting *
+findIntSetting (CCSContext *context)
+{
+    for (CCSPluginList p = context->plugins; p; p = p->next)
+    {
+	for (CCSSettingList l = p->data->settings; l; l = l->next)
+	{
+	    if (l->data->type == TypeInt)
+		return l->data;
+	}
+    }
+
+    return NULL;
+}
+
+/* whether the settings show what fileContent () wrote for generation, all
+   of them come from core, the KDE files through the integration */
+static bool
+pickedUp (CCSContext *context,
+	  EditTarget target,
+	  int        generation)
+{
+    CCSPlugin  *core = ccsFindPlugin (context, "core");
+    CCSSetting *setting;
+    bool       odd = generation & 1;
+
+    if (!core)
+	return false;
+
+    switch (target)
+    {
+    case EditMain:
+	{
+	    Bool bell;
+
+	    setting = ccsFindSetting (core, "audible_bell", FALSE, 0);
+
+	    return setting && ccsGetBool (setting, &bell) && !bell == !odd;
+	}
+    case EditKwin:
+	{
+	    Bool click;
+
+	    setting = ccsFindSetting (core, "click_to_focus", FALSE, 0);
+
+	    return setting && ccsGetBool (setting, &click) && !click == odd;
+	}
+    case EditShortcuts:
+	{
+	    CCSSettingKeyValue key;
+
+	    setting = ccsFindSetting (core, "close_window_key", FALSE, 0);
+
+	    if (!setting || !ccsGetKey (setting, &key))
+		return false;
+
+	    char *str = ccsKeyBindingToString (&key);
+	    bool same = str && !strcmp (str, (odd) ? "<Alt>F5" : "<Alt>F4");
+
+	    free (str);
+
+	    return same;
+	}
+    default:
+	return false;
+    }
+}
+
+static void
+readAll (CCSBackendVTable *vTable,
+	 CCSContext       *context)
+{
+    vTable->readInit (context);
+
+    for (CCSPluginList p = context->plugins; p; p = p->next)
+	for (CCSSettingList l = p->data->settings; l; l = l->next)
+	    vTable->readSetting (context, l->data);
+
+    if (vTable->readDone)
+	vTable->readDone (context);
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr,
+	     "usage: %s [-b backend] [-d seconds] [-r writes/s] [-s bytes]\n"
+	     "       [-n noop%%] [-w own writes/s] [-f main,kwin,shortcuts]\n",
+	     name);
+}
+
+static bool
+parseOptions (int     argc,
+	      char    **argv,
+	      Options *options)
+{
+    int opt;
+
+    options->backend  = BACKEND_PATH;
+    options->duration = 10;
+    options->rate     = 20;
+    options->size     = 16 * 1024;
+    options->noop     = 0;
+    options->ownRate  = 5;
+
+    for (int i = 0; i < N_EDITS; i++)
+	options->edit[i] = true;
+
+    while ((opt = getopt (argc, argv, "b:d:r:s:n:w:f:h")) != -1)
+    {
+	switch (opt)
+	{
+	case 'b':
+	    options->backend = optarg;
+	    break;
+	case 'd':
+	    options->duration = atoi (optarg);
+	    break;
+	case 'r':
+	    options->rate = atoi (optarg);
+	    break;
+	case 's':
+	    options->size = atoi (optarg);
+	    break;
+	case 'n':
+	    options->noop = atoi (optarg);
+	    break;
+	case 'w':
+	    options->ownRate = atoi (optarg);
+	    break;
+	case 'f':
+	    {
+		QStringList files = QString (optarg).split (',');
+
+		options->edit[EditMain]      = files.contains ("main");
+		options->edit[EditKwin]      = files.contains ("kwin");
+		options->edit[EditShortcuts] = files.contains ("shortcuts");
+	    }
+	    break;
+	default:
+	    return false;
+	}
+    }
+
+    return options->duration > 0 && options->rate > 0 &&
+	   options->size >= 0 && options->ownRate >= 0;
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    Options options;
+
+    if (!parseOptions (argc, argv, &options))
+    {
+	usage (argv[0]);
+	return 1;
+    }
+
+    char home[] = "/tmp/reload-storm-XXXXXX";
+
+    if (!mkdtemp (home))
+    {
+	perror ("mkdtemp");
+	return 1;
+    }
+
+    QString configDir = QString (home) + "/share/config/";
+
+    QDir ().mkpath (configDir);
+    setenv ("KDEHOME", home, 1);
+
+    for (int i = 0; i < N_EDITS; i++)
+	writeFile (configDir + editFiles[i],
+		   fileContent ((EditTarget) i, 0, options.size));
+
+    QCoreApplication app (argc, argv);
+
+    void *dlhand = dlopen (QFile::encodeName (options.backend).constData (),
+			   RTLD_NOW | RTLD_LOCAL);
+
+    if (!dlhand)
+    {
+	fprintf (stderr, "%s\n", dlerror ());
+	removeTree (home);
+	return 1;
+    }
+
+    GetBackendInfoProc        getInfo = (GetBackendInfoProc)
+	dlsym (dlhand, "getBackendInfo");
+    GetBackendReloadStatsProc getStats = (GetBackendReloadStatsProc)
+	dlsym (dlhand, "getBackendReloadStats");
+
+    if (!getInfo || !getStats)
+    {
+	fprintf (stderr, "%s is not the kconfig4 backend\n",
+		 options.backend.toLocal8Bit ().constData ());
+	dlclose (dlhand);
+	removeTree (home);
+	return 1;
+    }
+
+    CCSBackendVTable *vTable  = getInfo ();
+    CCSContext       *context = ccsEmptyContextNew (0);
+
+    ccsLoadPlugins (context);
+    ccsSetIntegrationEnabled (context, TRUE);
+
+    quint64 start = timeUsec ();
+
+    vTable->init (context);
+    readAll (vTable, context);
+
+    quint64 initTime = timeUsec () - start;
+
+    QList<Editor *> editors;
+
+    for (int i = 0; i < N_EDITS; i++)
+    {
+	if (!options.edit[i])
+	    continue;
+
+	editors.append (new Editor (configDir + editFiles[i],
+				    (EditTarget) i, options));
+	editors.last ()->start ();
+    }
+
+    CCSSetting   *setting = findIntSetting (context);
+    quint64      end = timeUsec () + (quint64) options.duration * 1000000;
+    quint64      nextWrite = timeUsec ();
+    quint64      maxStall = 0, eventTime = 0, writeTime = 0;
+    unsigned int ownWrites = 0;
+
+    while (timeUsec () < end)
+    {
+	quint64 t = timeUsec ();
+
+	ccsProcessEvents (context, ProcessEventsNoGlibMainLoopMask);
+
+	quint64 stall = timeUsec () - t;
+
+	eventTime += stall;
+	maxStall   = qMax (maxStall, stall);
+
+	if (setting && options.ownRate && timeUsec () >= nextWrite)
+	{
+	    int value;
+
+	    ccsGetInt (setting, &value);
+	    ccsSetInt (setting, (value == setting->info.forInt.min) ?
+		       value + 1 : value - 1);
+
+	    t = timeUsec ();
+
+	    vTable->writeInit (context);
+	    vTable->writeSetting (context, setting);
+	    vTable->writeDone (context);
+
+	    stall = timeUsec () - t;
+
+	    writeTime += stall;
+	    maxStall   = qMax (maxStall, stall);
+	    ownWrites++;
+
+	    nextWrite += 1000000 / options.ownRate;
+	}
+
+	::usleep (1000);
+    }
+
+    unsigned int externalWrites = 0;
+    int          finalGeneration[N_EDITS];
+
+    foreach (Editor *editor, editors)
+	editor->stop ();
+
+    /* nothing but the file watch tells the backend about the last
+       writes, a change it drops stays lost */
+    for (int i = 0, j = 0; i < N_EDITS; i++)
+    {
+	if (!options.edit[i])
+	    continue;
+
+	Editor *editor = editors[j++];
+
+	editor->wait ();
+	finalGeneration[i] = editor->finish ();
+	externalWrites += editor->writes ();
+	delete editor;
+    }
+
+    unsigned int lost;
+
+    end = timeUsec () + 2000000;
+
+    do
+    {
+	ccsProcessEvents (context, ProcessEventsNoGlibMainLoopMask);
+
+	lost = 0;
+
+	for (int i = 0; i < N_EDITS; i++)
+	{
+	    if (options.edit[i] &&
+		!pickedUp (context, (EditTarget) i, finalGeneration[i]))
+		lost++;
+	}
+
+	::usleep (1000);
+    }
+    while (lost && timeUsec () < end);
+
+    unsigned int       reloads = 0, skipped = 0;
+    unsigned long long reloadTime = 0;
+
+    getStats (context, &reloads, &skipped, &reloadTime);
+
+    printf ("duration            %d s\n", options.duration);
+    printf ("file size           %d bytes\n", options.size);
+    printf ("external writes     %u (%d/s per file, %d%% unchanged)\n",
+	    externalWrites, options.rate, options.noop);
+    printf ("own writes          %u\n", ownWrites);
+    printf ("init + first read   %.2f ms\n", initTime / 1000.0);
+    printf ("reloads             %u\n", reloads);
+    printf ("skipped reloads     %u\n", skipped);
+    printf ("reload time         %.2f ms\n", reloadTime / 1000.0);
+    printf ("event dispatch      %.2f ms\n", eventTime / 1000.0);
+    printf ("write passes        %.2f ms\n", writeTime / 1000.0);
+    printf ("max stall           %.2f ms\n", maxStall / 1000.0);
+    printf ("lost changes        %u\n", lost);
+
+    vTable->fini (context);
+    ccsContextDestroy (context);
+    dlclose (dlhand);
+
+    removeTree (home);
+
+    return (lost) ? 1 : 0;
+}
@@ -0,0 +1,508 @@
+/*
+ *  Reader vs. reload stress test for the KDE4 libcompizconfig backend
+ *
+ *  Loads the backend into a throw-away KDEHOME and lets reader threads
+ *  call readSetting () in a loop while the main thread writes settings,
+ *  an editor thread rewrites compizrc and kwinrc behind the backend's
+ *  back and file watch events reload them. Every value a reader gets
+ *  must be one that was written at some point.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QDir>
+#include <QThread>
+#include <QStringList>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+
+extern "C"
+{
+#include <ccs.h>
+#include <ccs-backend.h>
+}
+
+#ifndef BACKEND_PATH
+#define BACKEND_PATH "libkconfig4.so"
+#endif
+
+typedef CCSBackendVTable *(*GetBackendInfoProc) (void);
+
+typedef struct _Options
+{
+    QString backend;
+    int     duration;	/* seconds */
+    int     readers;	/* threads */
+    int     rate;	/* external and own writes per second */
+    bool    store;	/* profile in an SQLite store */
+}
+Options;
+
+/* the int setting everybody looks at, it only ever holds low or high */
+typedef struct _Probe
+{
+    QByteArray group;
+    QByteArray name;
+    int        low;
+    int        high;
+}
+Probe;
+
+static quint64
+timeUsec ()
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+
+    return (quint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void
+writeFile (const QString    &path,
+	   const QByteArray &data)
+{
+    QFile f (path);
+
+    if (f.open (QIODevice::WriteOnly | QIODevice::Truncate))
+	f.write (data);
+}
+
+static QByteArray
+mainContent (const Probe &probe,
+	     int         generation)
+{
+    return "[" + probe.group + "]\n" + probe.name + "=" +
+	   QByteArray::number ((generation & 1) ? probe.high : probe.low) +
+	   "\n";
+}
+
+static QByteArray
+kwinContent (int generation)
+{
+    QByteArray data ("[Windows]\n");
+
+    data += (generation & 1) ? "FocusPolicy=FocusFollowsMouse\n" :
+			       "FocusPolicy=ClickToFocus\n";
+    data += "BorderSnapZone=" + QByteArray::number (generation % 32) + "\n";
+
+    return data;
+}
+
+static CCSSetting *
+findIntSetting (CCSContext *context)
+{
+    for (CCSPluginList p = context->plugins; p; p = p->next)
+    {
+	for (CCSSettingList l = p->data->settings; l; l = l->next)
+	{
+	    if (l->data->type == TypeInt &&
+		l->data->info.forInt.max > l->data->info.forInt.min)
+		return l->data;
+	}
+    }
+
+    return NULL;
+}
+
+static CCSSetting *
+findProbeSetting (CCSContext *context,
+		  CCSSetting *setting)
+{
+    CCSPlugin *plugin = ccsFindPlugin (context, setting->parent->name);
+
+    if (!plugin)
+	return NULL;
+
+    return ccsFindSetting (plugin, setting->name, setting->isScreen,
+			   setting->screenNum);
+}
+
+class Editor : public QThread
+{
+    public:
+	Editor (const QString &configDir,
+		const Probe   &probe,
+		const Options &options) :
+	    mConfigDir (configDir),
+	    mProbe (probe),
+	    mOptions (options),
+	    mStop (false),
+	    mWrites (0)
+	{
+	}
+
+	void stop ()
+	{
+	    mStop = true;
+	}
+
+	unsigned int writes () const
+	{
+	    return mWrites;
+	}
+
+    protected:
+	void run ()
+	{
+	    for (int generation = 1; !mStop; generation++)
+	    {
+		/* a store profile never looks at compizrc again */
+		if (!mOptions.store)
+		    writeFile (mConfigDir + "compizrc",
+			       mainContent (mProbe, generation));
+
+		writeFile (mConfigDir + "kwinrc", kwinContent (generation));
+		mWrites++;
+
+		::usleep (1000000 / mOptions.rate);
+	    }
+	}
+
+    private:
+	QString       mConfigDir;
+	Probe         mProbe;
+	Options       mOptions;
+	volatile bool mStop;
+	unsigned int  mWrites;
+};
+
+/* Reads into the settings of a context of its own, so the threads only
+   share the backend and never a CCSSetting. */
+class Reader : public QThread
+{
+    public:
+	Reader (CCSBackendVTable *vTable,
+		CCSContext       *context,
+		CCSSetting       *setting,
+		const Probe      &probe) :
+	    mVTable (vTable),
+	    mContext (context),
+	    mProbe (probe),
+	    mStop (false),
+	    mReads (0),
+	    mBadReads (0)
+	{
+	    mOwn = ccsEmptyContextNew (0);
+	    ccsLoadPlugins (mOwn);
+
+	    mProbeSetting = findProbeSetting (mOwn, setting);
+	}
+
+	~Reader ()
+	{
+	    ccsContextDestroy (mOwn);
+	}
+
+	void stop ()
+	{
+	    mStop = true;
+	}
+
+	unsigned int reads () const
+	{
+	    return mReads;
+	}
+
+	unsigned int badReads () const
+	{
+	    return mBadReads;
+	}
+
+    protected:
+	void run ()
+	{
+	    while (!mStop)
+	    {
+		for (CCSPluginList p = mOwn->plugins; p; p = p->next)
+		{
+		    for (CCSSettingList l = p->data->settings; l; l = l->next)
+		    {
+			mVTable->readSetting (mContext, l->data);
+			mReads++;
+		    }
+		}
+
+		if (mProbeSetting)
+		{
+		    int value;
+
+		    mVTable->readSetting (mContext, mProbeSetting);
+		    ccsGetInt (mProbeSetting, &value);
+
+		    if (value != mProbe.low && value != mProbe.high)
+			mBadReads++;
+		}
+	    }
+	}
+
+    private:
+	CCSBackendVTable *mVTable;
+	CCSContext       *mContext;
+	CCSContext       *mOwn;
+	CCSSetting       *mProbeSetting;
+	Probe            mProbe;
+	volatile bool    mStop;
+	unsigned int     mReads;
+	unsigned int     mBadReads;
+};
+
+static void
+removeTree (const QString &path)
+{
+    QDir dir (path);
+
+    foreach (const QFileInfo &info,
+	     dir.entryInfoList (QDir::AllEntries | QDir::NoDotAndDotDot |
+				QDir::Hidden | QDir::System))
+    {
+	if (info.isDir () && !info.isSymLink ())
+	    removeTree (info.filePath ());
+	else
+	    QFile::remove (info.filePath ());
+    }
+
+    dir.rmdir (path);
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr,
+	     "usage: %s [-b backend] [-d seconds] [-t readers] "
+	     "[-r writes/s] [-s]\n", name);
+}
+
+static bool
+parseOptions (int     argc,
+	      char    **argv,
+	      Options *options)
+{
+    int opt;
+
+    options->backend  = BACKEND_PATH;
+    options->duration = 10;
+    options->readers  = 4;
+    options->rate     = 50;
+    options->store    = false;
+
+    while ((opt = getopt (argc, argv, "b:d:t:r:sh")) != -1)
+    {
+	switch (opt)
+	{
+	case 'b':
+	    options->backend = optarg;
+	    break;
+	case 'd':
+	    options->duration = atoi (optarg);
+	    break;
+	case 't':
+	    options->readers = atoi (optarg);
+	    break;
+	case 'r':
+	    options->rate = atoi (optarg);
+	    break;
+	case 's':
+	    options->store = true;
+	    break;
+	default:
+	    return false;
+	}
+    }
+
+    return options->duration > 0 && options->readers > 0 &&
+	   options->rate > 0;
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    Options options;
+
+    if (!parseOptions (argc, argv, &options))
+    {
+	usage (argv[0]);
+	return 1;
+    }
+
+    char home[] = "/tmp/snapshot-stress-XXXXXX";
+
+    if (!mkdtemp (home))
+    {
+	perror ("mkdtemp");
+	return 1;
+    }
+
+    QString configDir = QString (home) + "/share/config/";
+
+    QDir ().mkpath (configDir);
+    setenv ("KDEHOME", home, 1);
+
+    QCoreApplication app (argc, argv);
+
+    void *dlhand = dlopen (QFile::encodeName (options.backend).constData (),
+			   RTLD_NOW | RTLD_LOCAL);
+
+    if (!dlhand)
+    {
+	fprintf (stderr, "%s\n", dlerror ());
+	removeTree (home);
+	return 1;
+    }
+
+    GetBackendInfoProc getInfo = (GetBackendInfoProc)
+	dlsym (dlhand, "getBackendInfo");
+
+    if (!getInfo)
+    {
+	fprintf (stderr, "%s is not a compizconfig backend\n",
+		 options.backend.toLocal8Bit ().constData ());
+	dlclose (dlhand);
+	removeTree (home);
+	return 1;
+    }
+
+    CCSBackendVTable *vTable  = getInfo ();
+    CCSContext       *context = ccsEmptyContextNew (0);
+
+    ccsLoadPlugins (context);
+    ccsSetIntegrationEnabled (context, TRUE);
+
+    CCSSetting *setting = findIntSetting (context);
+
+    if (!setting)
+    {
+	fprintf (stderr, "no int setting to probe\n");
+	ccsContextDestroy (context);
+	dlclose (dlhand);
+	removeTree (home);
+	return 1;
+    }
+
+    Probe probe;
+
+    probe.group = setting->parent->name;
+    probe.group += (setting->isScreen) ?
+		   "_screen" + QByteArray::number (setting->screenNum) :
+		   QByteArray ("_display");
+    probe.name  = setting->name;
+    probe.low   = setting->info.forInt.min;
+    probe.high  = setting->info.forInt.min + 1;
+
+    writeFile (configDir + "compizrc", mainContent (probe, 0));
+    writeFile (configDir + "kwinrc", kwinContent (0));
+
+    if (options.store)
+	writeFile (configDir + "ccs-backend-kconfig4rc",
+		   "[Profile Default]\nStorage=SQLite\n");
+
+    vTable->init (context);
+    vTable->readInit (context);
+
+    for (CCSPluginList p = context->plugins; p; p = p->next)
+	for (CCSSettingList l = p->data->settings; l; l = l->next)
+	    vTable->readSetting (context, l->data);
+
+    if (vTable->readDone)
+	vTable->readDone (context);
+
+    QList<Reader *> readers;
+
+    for (int i = 0; i < options.readers; i++)
+	readers.append (new Reader (vTable, context, setting, probe));
+
+    Editor editor (configDir, probe, options);
+
+    foreach (Reader *reader, readers)
+	reader->start ();
+
+    editor.start ();
+
+    quint64      end = timeUsec () + (quint64) options.duration * 1000000;
+    quint64      nextWrite = timeUsec ();
+    unsigned int ownWrites = 0;
+    int          generation = 0;
+
+    while (timeUsec () < end)
+    {
+	ccsProcessEvents (context, ProcessEventsNoGlibMainLoopMask);
+
+	if (timeUsec () >= nextWrite)
+	{
+	    generation++;
+	    ccsSetInt (setting, (generation & 1) ? probe.high : probe.low);
+
+	    vTable->writeInit (context);
+	    vTable->writeSetting (context, setting);
+	    vTable->writeDone (context);
+
+	    /* a read pass of its own now and then, like a profile switch */
+	    if (generation % 16 == 0)
+	    {
+		vTable->readInit (context);
+		vTable->readSetting (context, setting);
+
+		if (vTable->readDone)
+		    vTable->readDone (context);
+	    }
+
+	    ownWrites++;
+	    nextWrite += 1000000 / options.rate;
+	}
+
+	::usleep (500);
+    }
+
+    editor.stop ();
+    editor.wait ();
+
+    unsigned int reads = 0, badReads = 0;
+
+    foreach (Reader *reader, readers)
+	reader->stop ();
+
+    foreach (Reader *reader, readers)
+    {
+	reader->wait ();
+	reads    += reader->reads ();
+	badReads += reader->badReads ();
+	delete reader;
+    }
+
+    printf ("duration            %d s\n", options.duration);
+    printf ("profile             %s\n", (options.store) ? "SQLite" : "INI");
+    printf ("reader threads      %d\n", options.readers);
+    printf ("reads               %u\n", reads);
+    printf ("external writes     %u\n", editor.writes ());
+    printf ("own writes          %u\n", ownWrites);
+    printf ("inconsistent reads  %u\n", badReads);
+
+    vTable->fini (context);
+    ccsContextDestroy (context);
+    dlclose (dlhand);
+
+    removeTree (home);
+
+    return (badReads) ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+/*
+ *  Binding conversion cache for the KDE4 libcompizconfig backend
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QThreadStorage>
+
+#include <KDebug>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "binding_cache.h"
+
+/* the conversions only depend on the strings and values, so a thread
+   shares its cache between contexts and never with other threads */
+BindingCache &
+bindingCache ()
+{
+    static QThreadStorage<BindingCache *> caches;
+
+    if (!caches.hasLocalData ())
+	caches.setLocalData (new BindingCache ());
+
+    return *caches.localData ();
+}
+
+void
+resetBindingCache (const char *pass)
+{
+    BindingCache &cache = bindingCache ();
+
+    if (pass && (cache.hits || cache.misses))
+	kDebug () << pass << "binding conversions:" << cache.hits
+		  << "cached," << cache.misses << "converted" << endl;
+
+    cache.keys.clear ();
+    cache.buttons.clear ();
+    cache.edges.clear ();
+
+    cache.hits   = 0;
+    cache.misses = 0;
+}
+
+Bool
+cachedStringToKeyBinding (const QByteArray   &str,
+			  CCSSettingKeyValue *value)
+{
+    BindingCache                                 &cache = bindingCache ();
+    QHash<QByteArray, CachedKey>::const_iterator it =
+	cache.keys.constFind (str);
+
+    if (it != cache.keys.constEnd ())
+    {
+	cache.hits++;
+	if (it->valid)
+	    *value = it->value;
+	return it->valid;
+    }
+
+    CachedKey entry;
+
+    entry.value.keysym     = 0;
+    entry.value.keyModMask = 0;
+    entry.valid = ccsStringToKeyBinding (str.constData (), &entry.value);
+    cache.misses++;
+
+    if (cache.keys.size () >= BINDING_CACHE_SIZE)
+	cache.keys.clear ();
+    cache.keys.insert (str, entry);
+
+    if (entry.valid)
+	*value = entry.value;
+
+    return entry.valid;
+}
+
+Bool
+cachedStringToButtonBinding (const QByteArray      &str,
+			     CCSSettingButtonValue *value)
+{
+    BindingCache                                    &cache = bindingCache ();
+    QHash<QByteArray, CachedButton>::const_iterator it =
+	cache.buttons.constFind (str);
+
+    if (it != cache.buttons.constEnd ())
+    {
+	cache.hits++;
+	if (it->valid)
+	    *value = it->value;
+	return it->valid;
+    }
+
+    CachedButton entry;
+
+    memset (&entry.value, 0, sizeof (CCSSettingButtonValue));
+    entry.valid = ccsStringToButtonBinding (str.constData (), &entry.value);
+    cache.misses++;
+
+    if (cache.buttons.size () >= BINDING_CACHE_SIZE)
+	cache.buttons.clear ();
+    cache.buttons.insert (str, entry);
+
+    if (entry.valid)
+	*value = entry.value;
+
+    return entry.valid;
+}
+
+unsigned int
+cachedStringToEdges (const QByteArray &str)
+{
+    BindingCache                                    &cache = bindingCache ();
+    QHash<QByteArray, unsigned int>::const_iterator it =
+	cache.edges.constFind (str);
+
+    if (it != cache.edges.constEnd ())
+    {
+	cache.hits++;
+	return *it;
+    }
+
+    unsigned int edges = ccsStringToEdges (str.constData ());
+    cache.misses++;
+
+    if (cache.edges.size () >= BINDING_CACHE_SIZE)
+	cache.edges.clear ();
+    cache.edges.insert (str, edges);
+
+    return edges;
+}
+
+QByteArray
+cachedKeyBindingToString (CCSSettingKeyValue *value)
+{
+    BindingCache &cache = bindingCache ();
+    quint64      id = ((quint64) value->keyModMask << 32) |
+		      (quint64) value->keysym;
+
+    QHash<quint64, QByteArray>::const_iterator it =
+	cache.keyStrings.constFind (id);
+
+    if (it != cache.keyStrings.constEnd ())
+    {
+	cache.hits++;
+	return *it;
+    }
+
+    char       *val = ccsKeyBindingToString (value);
+    QByteArray str (val);
+
+    free (val);
+    cache.misses++;
+
+    if (cache.keyStrings.size () >= BINDING_CACHE_SIZE)
+	cache.keyStrings.clear ();
+    cache.keyStrings.insert (id, str);
+
+    return str;
+}
+
+QByteArray
+cachedButtonBindingToString (CCSSettingButtonValue *value)
+{
+    BindingCache &cache = bindingCache ();
+    quint64      id = ((quint64) value->buttonModMask << 32) |
+		      ((quint64) (value->edgeMask & 0xffff) << 16) |
+		      (quint64) (value->button & 0xffff);
+
+    QHash<quint64, QByteArray>::const_iterator it =
+	cache.buttonStrings.constFind (id);
+
+    if (it != cache.buttonStrings.constEnd ())
+    {
+	cache.hits++;
+	return *it;
+    }
+
+    char       *val = ccsButtonBindingToString (value);
+    QByteArray str (val);
+
+    free (val);
+    cache.misses++;
+
+    if (cache.buttonStrings.size () >= BINDING_CACHE_SIZE)
+	cache.buttonStrings.clear ();
+    cache.buttonStrings.insert (id, str);
+
+    return str;
+}
+
+QByteArray
+cachedEdgesToString (unsigned int edges)
+{
+    BindingCache                                    &cache = bindingCache ();
+    QHash<unsigned int, QByteArray>::const_iterator it =
+	cache.edgeStrings.constFind (edges);
+
+    if (it != cache.edgeStrings.constEnd ())
+    {
+	cache.hits++;
+	return *it;
+    }
+
+    char       *val = ccsEdgesToString (edges);
+    QByteArray str (val);
+
+    free (val);
+    cache.misses++;
+
+    if (cache.edgeStrings.size () >= BINDING_CACHE_SIZE)
+	cache.edgeStrings.clear ();
+    cache.edgeStrings.insert (edges, str);
+
+    return str;
+}
@@ -0,0 +1,94 @@
+/*
+ *  Binding conversion cache for the KDE4 libcompizconfig backend
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef _KCONFIG4_BINDING_CACHE_H
+#define _KCONFIG4_BINDING_CACHE_H
+
+#include <QByteArray>
+#include <QHash>
+
+extern "C"
+{
+#include <ccs.h>
+}
+
+#define BINDING_CACHE_SIZE 256
+
+typedef struct _CachedKey
+{
+    Bool                  valid;
+    CCSSettingKeyValue    value;
+}
+CachedKey;
+
+typedef struct _CachedButton
+{
+    Bool                  valid;
+    CCSSettingButtonValue value;
+}
+CachedButton;
+
+/* string <-> binding conversions, one cache per thread, see
+   bindingCache () */
+typedef struct _BindingCache
+{
+    QHash<QByteArray, CachedKey>          keys;
+    QHash<QByteArray, CachedButton>       buttons;
+    QHash<QByteArray, unsigned int>       edges;
+
+    /* kept across passes, the strings only depend on the values */
+    QHash<quint64, QByteArray>            keyStrings;
+    QHash<quint64, QByteArray>            buttonStrings;
+    QHash<unsigned int, QByteArray>       edgeStrings;
+
+    unsigned int                          hits;
+    unsigned int                          misses;
+}
+BindingCache;
+
+/* the calling thread's cache */
+BindingCache &
+bindingCache ();
+
+/* forgets the string -> binding conversions at the start of a read or
+   write pass, logging the counts of the pass if there is one */
+void
+resetBindingCache (const char *pass);
+
+Bool
+cachedStringToKeyBinding (const QByteArray   &str,
+			  CCSSettingKeyValue *value);
+
+Bool
+cachedStringToButtonBinding (const QByteArray      &str,
+			     CCSSettingButtonValue *value);
+
+unsigned int
+cachedStringToEdges (const QByteArray &str);
+
+QByteArray
+cachedKeyBindingToString (CCSSettingKeyValue *value);
+
+QByteArray
+cachedButtonBindingToString (CCSSettingButtonValue *value);
+
+QByteArray
+cachedEdgesToString (unsigned int edges);
+
+#endif
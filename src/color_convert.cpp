@@ -0,0 +1,197 @@
+/*
+ *  Color conversions for the KDE4 libcompizconfig backend
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ini_file.h"
+#include "color_convert.h"
+
+bool
+hexToColor (const char           *hex,
+	    CCSSettingColorValue *color)
+{
+    unsigned short channels[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+	int byte = 0;
+
+	for (int j = 0; j < 2; j++)
+	{
+	    int digit = hexDigit (hex[i * 2 + j]);
+
+	    if (digit < 0)
+		return false;
+
+	    byte = (byte << 4) | digit;
+	}
+
+	channels[i] = (byte << 8) | byte;
+    }
+
+    color->color.red   = channels[0];
+    color->color.green = channels[1];
+    color->color.blue  = channels[2];
+    color->color.alpha = channels[3];
+
+    return true;
+}
+
+void
+colorToHex (const CCSSettingColorValue *color,
+	    char                       *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < 4; i++)
+    {
+	hex[i * 2]     = digits[(color->array[i] >> 12) & 0xf];
+	hex[i * 2 + 1] = digits[(color->array[i] >> 8) & 0xf];
+    }
+}
+
+Bool
+stringToColor (const QByteArray     &str,
+	       CCSSettingColorValue *color)
+{
+    if (str.length () == 9 && str[0] == '#' &&
+	hexToColor (str.constData () + 1, color))
+	return TRUE;
+
+    return ccsStringToColor (str.constData (), color);
+}
+
+void
+hexToColorsScalar (const char *const    *hex,
+		   CCSSettingColorValue *colors,
+		   bool                 *valid,
+		   int                  n)
+{
+    for (int i = 0; i < n; i++)
+	valid[i] = hex[i] && hexToColor (hex[i], &colors[i]);
+}
+
+void
+colorsToHexScalar (const CCSSettingColorValue *colors,
+		   char                       *hex,
+		   int                        n)
+{
+    for (int i = 0; i < n; i++)
+	colorToHex (&colors[i], hex + i * 8);
+}
+
+#ifdef __SSE2__
+void
+hexToColorsSse2 (const char *const    *hex,
+		 CCSSettingColorValue *colors,
+		 bool                 *valid,
+		 int                  n)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    int           i;
+
+    for (i = 0; i + 2 <= n; i += 2)
+    {
+	if (!hex[i] || !hex[i + 1])
+	{
+	    hexToColorsScalar (hex + i, colors + i, valid + i, 2);
+	    continue;
+	}
+
+	const __m128i v =
+	    _mm_unpacklo_epi64 (_mm_loadl_epi64 ((const __m128i *) hex[i]),
+				_mm_loadl_epi64 ((const __m128i *) hex[i + 1]));
+	const __m128i digit = _mm_sub_epi8 (v, _mm_set1_epi8 ('0'));
+	const __m128i alpha = _mm_sub_epi8 (_mm_or_si128 (v, _mm_set1_epi8 (0x20)),
+					    _mm_set1_epi8 ('a'));
+	const __m128i isDigit =
+	    _mm_cmpeq_epi8 (_mm_subs_epu8 (digit, _mm_set1_epi8 (9)), zero);
+	const __m128i isAlpha =
+	    _mm_cmpeq_epi8 (_mm_subs_epu8 (alpha, _mm_set1_epi8 (5)), zero);
+	unsigned int  ok = _mm_movemask_epi8 (_mm_or_si128 (isDigit, isAlpha));
+
+	if (ok != 0xffff)
+	{
+	    hexToColorsScalar (hex + i, colors + i, valid + i, 2);
+	    continue;
+	}
+
+	const __m128i nibbles =
+	    _mm_or_si128 (_mm_and_si128 (isDigit, digit),
+			  _mm_and_si128 (isAlpha,
+					 _mm_add_epi8 (alpha, _mm_set1_epi8 (10))));
+	/* a 16 bit lane holds the high digit of a channel in its low
+	   byte, the channel is that byte times 0x101 */
+	const __m128i bytes =
+	    _mm_or_si128 (_mm_slli_epi16 (_mm_and_si128 (nibbles,
+							 _mm_set1_epi16 (0xff)), 4),
+			  _mm_srli_epi16 (nibbles, 8));
+	unsigned short channels[8];
+
+	_mm_storeu_si128 ((__m128i *) channels,
+			  _mm_or_si128 (bytes, _mm_slli_epi16 (bytes, 8)));
+
+	for (int j = 0; j < 4; j++)
+	{
+	    colors[i].array[j]     = channels[j];
+	    colors[i + 1].array[j] = channels[j + 4];
+	}
+
+	valid[i]     = true;
+	valid[i + 1] = true;
+    }
+
+    hexToColorsScalar (hex + i, colors + i, valid + i, n - i);
+}
+
+void
+colorsToHexSse2 (const CCSSettingColorValue *colors,
+		 char                       *hex,
+		 int                        n)
+{
+    int i;
+
+    for (i = 0; i + 2 <= n; i += 2)
+    {
+	const __m128i v =
+	    _mm_set_epi16 (colors[i + 1].array[3], colors[i + 1].array[2],
+			   colors[i + 1].array[1], colors[i + 1].array[0],
+			   colors[i].array[3], colors[i].array[2],
+			   colors[i].array[1], colors[i].array[0]);
+	/* the two digits of a channel's high byte, high one first */
+	const __m128i nibbles =
+	    _mm_or_si128 (_mm_srli_epi16 (v, 12),
+			  _mm_and_si128 (v, _mm_set1_epi16 (0x0f00)));
+	const __m128i letters =
+	    _mm_and_si128 (_mm_cmpgt_epi8 (nibbles, _mm_set1_epi8 (9)),
+			   _mm_set1_epi8 ('a' - '0' - 10));
+
+	_mm_storeu_si128 ((__m128i *) (hex + i * 8),
+			  _mm_add_epi8 (_mm_add_epi8 (nibbles,
+						      _mm_set1_epi8 ('0')),
+					letters));
+    }
+
+    colorsToHexScalar (colors + i, hex + i * 8, n - i);
+}
+#endif
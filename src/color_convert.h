@@ -0,0 +1,101 @@
+/*
+ *  Color conversions for the KDE4 libcompizconfig backend
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef _KCONFIG4_COLOR_CONVERT_H
+#define _KCONFIG4_COLOR_CONVERT_H
+
+#include <QByteArray>
+
+extern "C"
+{
+#include <ccs.h>
+}
+
+/* "#rrggbbaa" is by far the most common color format, so decode and
+   encode its eight hex digits here and leave everything else to
+   ccsStringToColor; same results as ccsStringToColor and
+   ccsColorToString, which scan and print the high byte of a channel */
+bool
+hexToColor (const char           *hex,
+	    CCSSettingColorValue *color);
+
+void
+colorToHex (const CCSSettingColorValue *color,
+	    char                       *hex);
+
+Bool
+stringToColor (const QByteArray     &str,
+	       CCSSettingColorValue *color);
+
+/* Color lists are converted in one go: the "#rrggbbaa" digits of the
+   elements (NULL for any other format) are decoded into colors, valid
+   telling which ones were hex, and colors are encoded to 8 digits each.
+   The SSE2 versions do two colors per register and leave an odd one out
+   to the scalar ones; both give the same results as hexToColor and
+   colorToHex. */
+void
+hexToColorsScalar (const char *const    *hex,
+		   CCSSettingColorValue *colors,
+		   bool                 *valid,
+		   int                  n);
+
+void
+colorsToHexScalar (const CCSSettingColorValue *colors,
+		   char                       *hex,
+		   int                        n);
+
+#ifdef __SSE2__
+void
+hexToColorsSse2 (const char *const    *hex,
+		 CCSSettingColorValue *colors,
+		 bool                 *valid,
+		 int                  n);
+
+void
+colorsToHexSse2 (const CCSSettingColorValue *colors,
+		 char                       *hex,
+		 int                        n);
+#endif
+
+static inline void
+hexToColors (const char *const    *hex,
+	     CCSSettingColorValue *colors,
+	     bool                 *valid,
+	     int                  n)
+{
+#ifdef __SSE2__
+    hexToColorsSse2 (hex, colors, valid, n);
+#else
+    hexToColorsScalar (hex, colors, valid, n);
+#endif
+}
+
+static inline void
+colorsToHex (const CCSSettingColorValue *colors,
+	     char                       *hex,
+	     int                        n)
+{
+#ifdef __SSE2__
+    colorsToHexSse2 (colors, hex, n);
+#else
+    colorsToHexScalar (colors, hex, n);
+#endif
+}
+
+#endif
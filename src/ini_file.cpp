@@ -0,0 +1,571 @@
+/*
+ *  INI file parser and writer for the KDE4 libcompizconfig backend
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QMutex>
+#include <QtAlgorithms>
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ini_file.h"
+
+/* group and key names, and the plugin, group and setting names of the
+   backend, shared by every context of the process */
+static QSet<QString> &
+internTable ()
+{
+    static QSet<QString> strings;
+
+    return strings;
+}
+
+static QMutex &
+internTableLock ()
+{
+    static QMutex lock;
+
+    return lock;
+}
+
+QString
+internString (const QString &string)
+{
+    QMutexLocker                  locker (&internTableLock ());
+    QSet<QString>                 &strings = internTable ();
+    QSet<QString>::const_iterator it = strings.constFind (string);
+
+    if (it != strings.constEnd ())
+	return *it;
+
+    strings.insert (string);
+
+    return string;
+}
+
+/* one line of an INI file as found by nextIniLine () */
+typedef struct _IniLine
+{
+    const char *begin;
+    const char *end;
+    const char *equals;		/* first '=', or NULL */
+    const char *bracket;	/* first '[', or NULL */
+    bool       escaped;		/* has a '\\' */
+    bool       nonAscii;
+}
+IniLine;
+
+static inline void
+scanIniBytes (IniLine    &line,
+	      const char *p,
+	      unsigned   equals,
+	      unsigned   bracket,
+	      unsigned   backslash,
+	      unsigned   high)
+{
+    if (!line.equals && equals)
+	line.equals = p + __builtin_ctz (equals);
+    if (!line.bracket && bracket)
+	line.bracket = p + __builtin_ctz (bracket);
+
+    line.escaped  |= backslash != 0;
+    line.nonAscii |= high != 0;
+}
+
+/* finds the end of the line at p along with the characters that decide
+   how it has to be parsed, 16 bytes at a time */
+static bool
+nextIniLine (const char *&p,
+	     const char *end,
+	     IniLine    &line)
+{
+    if (p >= end)
+	return false;
+
+    line.begin    = p;
+    line.equals   = NULL;
+    line.bracket  = NULL;
+    line.escaped  = false;
+    line.nonAscii = false;
+
+#ifdef __SSE2__
+    for (; p + 16 <= end; p += 16)
+    {
+	const __m128i v = _mm_loadu_si128 ((const __m128i *) p);
+	unsigned newline =
+	    _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\n')));
+	unsigned mask = (newline) ? (newline & -newline) - 1 : 0xffff;
+
+	scanIniBytes (line, p,
+	    _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 ('='))) & mask,
+	    _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 ('['))) & mask,
+	    _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 ('\\'))) & mask,
+	    _mm_movemask_epi8 (v) & mask);
+
+	if (newline)
+	{
+	    line.end = p + __builtin_ctz (newline);
+	    p = line.end + 1;
+	    return true;
+	}
+    }
+#endif
+
+    for (; p < end && *p != '\n'; p++)
+    {
+	if (!line.equals && *p == '=')
+	    line.equals = p;
+	else if (!line.bracket && *p == '[')
+	    line.bracket = p;
+
+	line.escaped  |= *p == '\\';
+	line.nonAscii |= (*p & 0x80) != 0;
+    }
+
+    line.end = p;
+
+    if (p < end)
+	p++;
+
+    return true;
+}
+
+static inline bool
+isIniSpace (char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline void
+trimIni (const char *&begin,
+	 const char *&end)
+{
+    while (begin < end && isIniSpace (*begin))
+	begin++;
+    while (end > begin && isIniSpace (end[-1]))
+	end--;
+}
+
+/* KConfig's file level escapes, false for anything it would warn about */
+static bool
+unescapeIni (const char *begin,
+	     const char *end,
+	     QByteArray &out)
+{
+    out.truncate (0);
+    out.reserve (end - begin);
+
+    for (const char *p = begin; p < end; p++)
+    {
+	if (*p != '\\')
+	{
+	    out += *p;
+	    continue;
+	}
+
+	if (++p == end)
+	{
+	    out += '\\';
+	    break;
+	}
+
+	switch (*p)
+	{
+	case 's':
+	    out += ' ';
+	    break;
+	case 't':
+	    out += '\t';
+	    break;
+	case 'n':
+	    out += '\n';
+	    break;
+	case 'r':
+	    out += '\r';
+	    break;
+	case '\\':
+	    out += '\\';
+	    break;
+	case ',':
+	case ';':
+	    /* list separators, kept escaped for the list parser */
+	    out += '\\';
+	    out += *p;
+	    break;
+	case 'x':
+	    {
+		if (end - p < 3 || hexDigit (p[1]) < 0 || hexDigit (p[2]) < 0)
+		    return false;
+
+		out += (char) (hexDigit (p[1]) << 4 | hexDigit (p[2]));
+		p += 2;
+	    }
+	    break;
+	default:
+	    return false;
+	}
+    }
+
+    return true;
+}
+
+static bool
+iniField (const char *begin,
+	  const char *end,
+	  bool       escaped,
+	  QByteArray &out)
+{
+    if (escaped)
+	return unescapeIni (begin, end, out);
+
+    out = QByteArray (begin, end - begin);
+
+    return true;
+}
+
+static inline QString
+iniString (const QByteArray &field,
+	   bool             nonAscii)
+{
+    return (nonAscii) ? QString::fromUtf8 (field) : QString::fromLatin1 (field);
+}
+
+/* parses an INI file the way KConfig does. It gives up on anything
+   beyond plain groups and entries (entry flags, locales, nested groups,
+   kiosk markers, ...) that KConfig has to read; with wanted it only
+   keeps those groups and skips the others whatever they hold */
+bool
+parseIni (const char          *data,
+	  qint64              size,
+	  const QSet<QString> *wanted,
+	  ProfileEntries      &entries)
+{
+    GroupEntries *group = NULL;
+    QString      groupName;
+    bool         skip = wanted != NULL;	/* nothing before the first group */
+    const char   *p = data, *end = data + size;
+    IniLine      line;
+    QByteArray   key, value;
+
+    while (nextIniLine (p, end, line))
+    {
+	const char *begin = line.begin, *last = line.end;
+
+	trimIni (begin, last);
+
+	if (begin == last || *begin == '#')
+	    continue;
+
+	if (*begin == '[')
+	{
+	    const char *close = (const char *) memchr (begin, ']',
+						      last - begin);
+
+	    group = NULL;
+
+	    if (close != last - 1 || close - begin < 2 ||
+		memchr (begin + 1, '[', close - begin - 1) || begin[1] == '$' ||
+		!iniField (begin + 1, close, line.escaped, key))
+	    {
+		/* "[$i]" locks the whole file, "[Group][$i]" the group */
+		if (!wanted || begin[1] == '$' || !close ||
+		    (iniField (begin + 1, close, line.escaped, key) &&
+		     wanted->contains (iniString (key, line.nonAscii))))
+		    return false;
+
+		skip = true;
+		continue;
+	    }
+
+	    groupName = iniString (key, line.nonAscii);
+	    skip      = wanted && !wanted->contains (groupName);
+	    continue;
+	}
+
+	/* KConfig ignores lines without an entry, so do we */
+	if (skip || !line.equals)
+	    continue;
+
+	const char *keyEnd = line.equals, *valueBegin = line.equals + 1;
+
+	trimIni (begin, keyEnd);
+	trimIni (valueBegin, last);
+
+	if ((line.bracket && line.bracket < line.equals) ||
+	    begin == keyEnd || groupName.isEmpty () ||
+	    !iniField (begin, keyEnd, line.escaped, key) ||
+	    !iniField (valueBegin, last, line.escaped, value))
+	    return false;
+
+	if (line.nonAscii)
+	    value = QString::fromUtf8 (value).toUtf8 ();
+
+	if (!group)
+	    group = &entries[internString (groupName)];
+
+	group->insert (internString (iniString (key, line.nonAscii)), value);
+    }
+
+    return true;
+}
+
+/* KConfig's file level escapes, the reverse of unescapeIni () */
+static void
+escapeIni (QByteArray       &out,
+	   const QByteArray &field,
+	   bool             isKey)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (int i = 0; i < field.size (); i++)
+    {
+	unsigned char c = field[i];
+
+	switch (c)
+	{
+	case '\\':
+	    out += "\\\\";
+	    break;
+	case '\n':
+	    out += "\\n";
+	    break;
+	case '\t':
+	    out += "\\t";
+	    break;
+	case '\r':
+	    out += "\\r";
+	    break;
+	case ' ':
+	    if (i == 0 || i == field.size () - 1)
+		out += "\\s";
+	    else
+		out += ' ';
+	    break;
+	default:
+	    if (c < 0x20 || c == 0x7f ||
+		(isKey && (c == '=' || c == '[' || c == ']')))
+	    {
+		out += "\\x";
+		out += hex[c >> 4];
+		out += hex[c & 0xf];
+	    }
+	    else
+		out += c;
+	    break;
+	}
+    }
+}
+
+static QByteArray
+iniEntryLine (const QString    &key,
+	      const QByteArray &value)
+{
+    QByteArray line;
+
+    escapeIni (line, key.toUtf8 (), true);
+    line += '=';
+    escapeIni (line, value, false);
+
+    return line;
+}
+
+typedef struct _IniEdit
+{
+    int        pos;
+    int        len;
+    QByteArray text;
+}
+IniEdit;
+
+static bool
+iniEditBefore (const IniEdit &a,
+	       const IniEdit &b)
+{
+    return a.pos < b.pos;
+}
+
+/* Rewrites the lines of the dirty keys in data and adds the ones it does
+   not have yet, at the end of their group or in a new one. Every other
+   byte, including the groups we never loaded, stays as it is. False if
+   kiosk markers might lock a dirty key, which is up to KConfig then. */
+bool
+spliceIni (const QByteArray                     &data,
+	   const ProfileEntries                 &entries,
+	   const QHash<QString, QSet<QString> > &dirty,
+	   QByteArray                           &out)
+{
+    QHash<QString, QSet<QString> > missing = dirty;
+    QHash<QString, int>            groupEnd;
+    QList<IniEdit>                 edits;
+    QString                        group;
+    bool                           inGroup = false;
+    const char                     *start = data.constData ();
+    const char                     *p = start, *end = start + data.size ();
+    IniLine                        line;
+    QByteArray                     key;
+
+    while (nextIniLine (p, end, line))
+    {
+	const char *begin = line.begin, *last = line.end;
+
+	trimIni (begin, last);
+
+	if (begin == last || *begin == '#')
+	    continue;
+
+	if (*begin == '[')
+	{
+	    const char *close = (const char *) memchr (begin, ']',
+						      last - begin);
+
+	    if (begin[1] == '$' || !close)
+		return false;
+
+	    inGroup = close - begin >= 2 &&
+		      !memchr (begin + 1, '[', close - begin - 1) &&
+		      iniField (begin + 1, close, line.escaped, key);
+
+	    if (inGroup)
+	    {
+		group   = iniString (key, line.nonAscii);
+		inGroup = dirty.contains (group);
+
+		/* "[Group][$i]" and the like */
+		if (inGroup && close != last - 1)
+		    return false;
+	    }
+
+	    if (inGroup)
+		groupEnd[group] = line.end - start;
+
+	    continue;
+	}
+
+	if (!inGroup)
+	    continue;
+
+	groupEnd[group] = line.end - start;
+
+	if (!line.equals)
+	    continue;
+
+	if (line.bracket && line.bracket < line.equals)
+	{
+	    /* "Key[$i]=", locales are left alone */
+	    if (line.bracket[1] == '$')
+		return false;
+
+	    continue;
+	}
+
+	const char *keyEnd = line.equals;
+
+	trimIni (begin, keyEnd);
+
+	if (!iniField (begin, keyEnd, line.escaped, key))
+	    continue;
+
+	QString name = iniString (key, line.nonAscii);
+
+	if (!dirty[group].contains (name))
+	    continue;
+
+	IniEdit edit;
+
+	/* keeps the '\r' of a CRLF line */
+	edit.pos  = line.begin - start;
+	edit.len  = line.end - line.begin;
+	edit.text = iniEntryLine (name, entries[group].value (name));
+
+	if (edit.len && line.end[-1] == '\r')
+	    edit.len--;
+
+	edits.append (edit);
+	missing[group].remove (name);
+    }
+
+    QByteArray sections;
+
+    QHash<QString, QSet<QString> >::const_iterator it;
+
+    for (it = missing.constBegin (); it != missing.constEnd (); it++)
+    {
+	if (it.value ().isEmpty ())
+	    continue;
+
+	QByteArray lines;
+
+	foreach (const QString &name, it.value ())
+	{
+	    lines += '\n';
+	    lines += iniEntryLine (name, entries[it.key ()].value (name));
+	}
+
+	if (groupEnd.contains (it.key ()))
+	{
+	    IniEdit edit;
+
+	    edit.pos  = groupEnd[it.key ()];
+	    edit.len  = 0;
+	    edit.text = lines;
+
+	    edits.append (edit);
+	    continue;
+	}
+
+	if (!sections.isEmpty ())
+	    sections += '\n';
+
+	sections += '[';
+	escapeIni (sections, it.key ().toUtf8 (), true);
+	sections += ']';
+	sections += lines;
+	sections += '\n';
+    }
+
+    qStableSort (edits.begin (), edits.end (), iniEditBefore);
+
+    int pos = 0;
+
+    out.truncate (0);
+    out.reserve (data.size () + sections.size () + 256);
+
+    foreach (const IniEdit &edit, edits)
+    {
+	out.append (start + pos, edit.pos - pos);
+	out += edit.text;
+	pos = edit.pos + edit.len;
+    }
+
+    out.append (start + pos, data.size () - pos);
+
+    if (!sections.isEmpty ())
+    {
+	if (!out.isEmpty () && !out.endsWith ('\n'))
+	    out += '\n';
+	if (!out.isEmpty () && !out.endsWith ("\n\n"))
+	    out += '\n';
+
+	out += sections;
+    }
+
+    return true;
+}
@@ -0,0 +1,65 @@
+/*
+ *  INI file parser and writer for the KDE4 libcompizconfig backend
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef _KCONFIG4_INI_FILE_H
+#define _KCONFIG4_INI_FILE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+
+/* group -> key -> stored value (unescaped, UTF-8) */
+typedef QHash<QString, QByteArray>   GroupEntries;
+typedef QHash<QString, GroupEntries> ProfileEntries;
+
+static inline int
+hexDigit (char c)
+{
+    if (c >= '0' && c <= '9')
+	return c - '0';
+    if (c >= 'a' && c <= 'f')
+	return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+	return c - 'A' + 10;
+
+    return -1;
+}
+
+/* the one copy of a name the whole process shares */
+QString
+internString (const QString &string);
+
+/* parses an INI file the way KConfig does, false if KConfig has to read
+   it; with wanted it only keeps those groups */
+bool
+parseIni (const char          *data,
+	  qint64              size,
+	  const QSet<QString> *wanted,
+	  ProfileEntries      &entries);
+
+/* data with the dirty entries rewritten or added, false if KConfig has
+   to write them */
+bool
+spliceIni (const QByteArray                     &data,
+	   const ProfileEntries                 &entries,
+	   const QHash<QString, QSet<QString> > &dirty,
+	   QByteArray                           &out);
+
+#endif
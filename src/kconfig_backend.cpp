@@ -23,6 +23,26 @@
 #include <QFile>
 #include <QDir>
 #include <QList>
+#include <QHash>
+#include <QSet>
+#include <QPair>
+#include <QtAlgorithms>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QThread>
+#include <QThreadStorage>
+#include <QFuture>
+#include <QtConcurrentRun>
+#include <QCryptographicHash>
+#include <QVarLengthArray>
+#include <QVariant>
+
+#ifdef HAVE_PROFILE_STORE
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <QtSql/QSqlError>
+#endif
 
 #include <KConfig>
 #include <KConfigGroup>
@@ -33,8 +53,21 @@
 #include <KShortcut>
 
 #include "kwin_interface.h"
+#include "ini_file.h"
+#include "color_convert.h"
+#include "binding_cache.h"
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <locale.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 #include <X11/X.h>
 #include <X11/Xlib.h>
 
@@ -54,1752 +87,4618 @@ extern "C"
 #define CompNumLockMask    (1 << 21)
 #define CompScrollLockMask (1 << 22)
 
+#define INTERN_POINTER_CACHE_SIZE 4096	/* at least, see internCacheLimit */
+
+#define JOURNAL_SUFFIX        ".journal"
+#define COMPACTION_SUFFIX     ".ccs-compact"
+#define JOURNAL_DEFAULT_LIMIT (64 * 1024)
+
+#define STORE_SUFFIX          ".db"
+#define STORE_BUSY_TIMEOUT    "1000"	/* ms, QSQLITE_BUSY_TIMEOUT */
+#define STORE_READER_LIMIT    8		/* per thread */
+
+typedef enum
+{
+    FileMain,
+    FileKwin,
+    FileShortcuts,
+    N_FILES
+}
+ConfigFileId;
+
+/* what an event in the config directory can be about */
+typedef enum
+{
+    WatchMain,
+    WatchJournal,
+    WatchLayers,
+    WatchKwin,
+    WatchShortcuts,
+    N_WATCHED
+}
+WatchedFile;
+
+typedef enum
+{
+    CommitSequential,
+    CommitTransactional,
+    CommitJournal
+}
+CommitMode;
+
+/* kwinrc keys computed from more than one compiz setting */
+typedef enum
+{
+    DeriveSnapZones       = 1 << 0,
+    DeriveElectricBorders = 1 << 1
+}
+DerivedKey;
+
+typedef struct _KdeIntegration KdeIntegration;
+
+/* SQLite page file holding a profile instead of the compizrc INI file,
+   one row per (group, key) with the raw KConfig entry as value; kept
+   open by the context and by every snapshot reading from it */
+typedef struct _ProfileStore
+{
+    QAtomicInt  ref;
+    QString     connection;	/* of the thread driving the context */
+    QString     path;
+
+    /* connections of the reading threads, see storeReader () */
+    QMutex      readersLock;
+    QStringList readers;
+}
+ProfileStore;
+
+/* a thread's connection to a store and the groups it looked up there
+   for the snapshot of the given generation */
+typedef struct _StoreReader
+{
+    QString                      connection;
+    unsigned int                 generation;
+    QHash<QString, GroupEntries> groups;
+}
+StoreReader;
+
+/* immutable once published, freed by whoever drops the last reference;
+   everything readSetting () looks at is in here */
+typedef struct _ProfileSnapshot
+{
+    QAtomicInt     ref;
+    unsigned int   generation;
+    ProfileEntries entries;
+
+    /* read instead of entries if the profile lives in a store */
+    ProfileStore   *store;
+    KdeIntegration *integration;
+}
+ProfileSnapshot;
+
+/* kwinrc or kglobalshortcutsrc, with only the groups we integrate with
+   loaded; every other application keeps its groups in there as well */
+typedef struct _KdeFile
+{
+    QString        name;
+    QSet<QString>  groups;
+    ProfileEntries entries;
+    bool           kiosk;	/* has [$i] and the like, see loadKdeFile () */
+}
+KdeFile;
+
+/* Only the thread driving the context (init, read and write passes,
+   file watch events) touches this; other threads may call readSetting ()
+   at any time, which only goes through snapshot, epoch and readers. */
+/* What the last journal compaction did to the journal and the profile,
+   published before each of its writes can show up in the config
+   directory, see takeCompaction () */
+typedef struct _CompactionHashes
+{
+    QMutex     lock;
+    QByteArray journalBefore;
+    QByteArray journalAfter;
+    QByteArray mainBefore;
+    QByteArray mainAfter;
+}
+CompactionHashes;
+
 typedef struct _ConfigFiles
 {
+    CCSContext     *context;
+    QString        configDir;
     QString        profile;
 
     KConfig        *main;
-    KConfig        *kwin;
-    KConfig        *shortcuts;
+    QString        mainName;	/* while main is only opened on demand */
+    KdeFile        *kwin;
+    KdeFile        *shortcuts;
+    ProfileStore   *store;
+
+    QHash<QString, QSet<QString> > dirty[N_FILES];
+    CommitMode     commitMode;
+
+    /* DerivedKey bits to compute in writeDone (), once per pass */
+    unsigned int   derived;
+
+    QAtomicPointer<ProfileSnapshot> snapshot;
+    QAtomicInt                      epoch;
+    QAtomicInt                      readers[2];
+    QMutex                          publishLock;
+    unsigned int                    generation;
+
+    /* one watch on configDir, the inotify fd tells which files changed */
+    unsigned int   dirWatch;
+    int            inotifyFd;
 
-    Bool           modified;
-    unsigned int   mainWatch;
-    unsigned int   kwinWatch;
-    unsigned int   shortcutWatch;
+    /* parent profiles merged under the profile, most general first */
+    QStringList    layers;
+
+    int              journalLimit;
+    QFuture<void>    compaction;
+    CompactionHashes compacted;
+
+    /* content as of our last load or write, see reloadFile () */
+    QByteArray     fileHash[N_FILES];
+    QByteArray     journalHash;
+    QByteArray     layersHash;
+
+    /* reloadFile () activity, for getBackendReloadStats () */
+    unsigned int   reloads;
+    unsigned int   skippedReloads;
+    quint64        reloadTime;
+
+    /* for the next snapshot, NULL once the KDE files changed */
+    KdeIntegration *integration;
+
+    /* of the context's plugins at init, see internCacheLimit () */
+    int            settings;
 }
 ConfigFiles;
 
-static ConfigFiles *cFiles = NULL;
+typedef QHash<CCSContext *, ConfigFiles *> ContextFiles;
 
-typedef enum
+/* Every read looks its context up, but only init and fini change the
+   contexts, so they replace the whole hash and lookups take no lock;
+   the epochs work like those of acquireSnapshot/publishSnapshot. */
+typedef struct _ContextTable
 {
-    OptionInt,
-    OptionBool,
-    OptionKey,
-    OptionSpecial
+    QAtomicPointer<ContextFiles> files;
+    QAtomicInt                   epoch;
+    QAtomicInt                   readers[2];
 }
-SpecialOptionType;
+ContextTable;
 
-struct _SpecialOption
+static ContextTable &
+contextTable ()
 {
-    QString           settingName;
-    QString           pluginName;
-    QString           kdeName;
-    QString           groupName;
-    SpecialOptionType type;
+    static ContextTable table;
+
+    return table;
 }
 
-const specialOptions[] =
+/* serializes init, fini and what they set up for all contexts */
+static QMutex &
+contextFilesLock ()
 {
-    {"close_window_key", CORE_NAME, "Window Close", "kwin", OptionKey},
-    {"lower_window_key", CORE_NAME, "Window Lower", "kwin", OptionKey},
-    {"toggle_window_maximized_key", CORE_NAME, "Window Maximize", "kwin", OptionKey},
-    {"minimize_window_key", CORE_NAME, "Window Minimize", "kwin", OptionKey},
-    {"toggle_window_maximized_horizontally_key", CORE_NAME, "Window Maximize Horizontal", "kwin", OptionKey},
-    {"toggle_window_maximized_vertically_key", CORE_NAME, "Window Maximize Vertical", "kwin", OptionKey},
-    {"window_menu_key", CORE_NAME, "Window Operations Menu", "kwin", OptionKey},
-    
-    {"toggle_window_shaded_key", CORE_NAME, "Window Shade", "kwin", OptionKey},
-    {"raise_window_key", CORE_NAME, "Window Raise", "kwin", OptionKey},
-    {"toggle_window_fullscreen_key", CORE_NAME, "Window Fullscreen", "kwin", OptionKey},
-    {"run_command11_key", "commands", "Kill Window", "kwin", OptionKey},
-    {"initiate_key", "move", "Window Move", "kwin", OptionKey},
-    {"initiate_key", "resize", "Window Resize", "kwin", OptionKey},
-    {"rotate_right_key", "rotate", "Switch to Next Desktop", "kwin", OptionKey},
-    {"rotate_left_key", "rotate", "Switch to Previous Desktop", "kwin", OptionKey},
-    {"rotate_to_1_key", "rotate", "Switch to Desktop 1", "kwin", OptionKey},
-    {"rotate_to_2_key", "rotate", "Switch to Desktop 2", "kwin", OptionKey},
-    {"rotate_to_3_key", "rotate", "Switch to Desktop 3", "kwin", OptionKey},
-    {"rotate_to_4_key", "rotate", "Switch to Desktop 4", "kwin", OptionKey},
-    {"rotate_to_5_key", "rotate", "Switch to Desktop 5", "kwin", OptionKey},
-    {"rotate_to_6_key", "rotate", "Switch to Desktop 6", "kwin", OptionKey},
-    {"rotate_to_7_key", "rotate", "Switch to Desktop 7", "kwin", OptionKey},
-    {"rotate_to_8_key", "rotate", "Switch to Desktop 8", "kwin", OptionKey},
-    {"rotate_to_9_key", "rotate", "Switch to Desktop 9", "kwin", OptionKey},
-    {"rotate_to_10_key", "rotate", "Switch to Desktop 10", "kwin", OptionKey},
-    {"rotate_to_11_key", "rotate", "Switch to Desktop 11", "kwin", OptionKey},
-    {"rotate_to_12_key", "rotate", "Switch to Desktop 12", "kwin", OptionKey},
-    {"rotate_right_window_key", "rotate", "Window to Next Desktop", "kwin", OptionKey},
-    {"rotate_left_window_key", "rotate", "Window to Previous Desktop", "kwin", OptionKey},
-    {"rotate_to_1_window_key", "rotate", "Window to Desktop 1", "kwin", OptionKey},
-    {"rotate_to_2_window_key", "rotate", "Window to Desktop 2", "kwin", OptionKey},
-    {"rotate_to_3_window_key", "rotate", "Window to Desktop 3", "kwin", OptionKey},
-    {"rotate_to_4_window_key", "rotate", "Window to Desktop 4", "kwin", OptionKey},
-    {"rotate_to_5_window_key", "rotate", "Window to Desktop 5", "kwin", OptionKey},
-    {"rotate_to_6_window_key", "rotate", "Window to Desktop 6", "kwin", OptionKey},
-    {"rotate_to_7_window_key", "rotate", "Window to Desktop 7", "kwin", OptionKey},
-    {"rotate_to_8_window_key", "rotate", "Window to Desktop 8", "kwin", OptionKey},
-    {"rotate_to_9_window_key", "rotate", "Window to Desktop 9", "kwin", OptionKey},
-    {"rotate_to_10_window_key", "rotate", "Window to Desktop 10", "kwin", OptionKey},
-    {"rotate_to_11_window_key", "rotate", "Window to Desktop 11", "kwin", OptionKey},
-    {"rotate_to_12_window_key", "rotate", "Window to Desktop 12", "kwin", OptionKey},
+    static QMutex lock;
 
-    {"next_key", "wall", "Switch to Next Desktop", "kwin", OptionKey},
-    {"prev_key", "wall", "Switch to Previous Desktop", "kwin", OptionKey},
-    {"right_window_key", "wall", "Window One Desktop to the Right", "kwin", OptionKey},
-    {"left_window_key", "wall", "Window One Desktop to the Left", "kwin", OptionKey},
-    {"up_window_key", "wall", "Window One Desktop Up", "kwin", OptionKey},
-    {"down_window_key", "wall", "Window One Desktop Down", "kwin", OptionKey},
-    {"up_key", "wall", "Switch One Desktop Up", "kwin", OptionKey},
-    {"down_key", "wall", "Switch One Desktop Down", "kwin", OptionKey},
-    {"left_key", "wall", "Switch One Desktop to the Left", "kwin", OptionKey},
-    {"right_key", "wall", "Switch One Desktop to the Right", "kwin", OptionKey},
+    return lock;
+}
 
-    {"switch_to_1_key", "vpswitch", "Switch to Desktop 1", "kwin", OptionKey},
-    {"switch_to_2_key", "vpswitch", "Switch to Desktop 2", "kwin", OptionKey},
-    {"switch_to_3_key", "vpswitch", "Switch to Desktop 3", "kwin", OptionKey},
-    {"switch_to_4_key", "vpswitch", "Switch to Desktop 4", "kwin", OptionKey},
-    {"switch_to_5_key", "vpswitch", "Switch to Desktop 5", "kwin", OptionKey},
-    {"switch_to_6_key", "vpswitch", "Switch to Desktop 6", "kwin", OptionKey},
-    {"switch_to_7_key", "vpswitch", "Switch to Desktop 7", "kwin", OptionKey},
-    {"switch_to_8_key", "vpswitch", "Switch to Desktop 8", "kwin", OptionKey},
-    {"switch_to_9_key", "vpswitch", "Switch to Desktop 9", "kwin", OptionKey},
-    {"switch_to_10_key", "vpswitch", "Switch to Desktop 10", "kwin", OptionKey},
-    {"switch_to_11_key", "vpswitch", "Switch to Desktop 11", "kwin", OptionKey},
-    {"switch_to_12_key", "vpswitch", "Switch to Desktop 12", "kwin", OptionKey},
+/* KGlobal::dirs () is one object for the whole process and not thread
+   safe, and KConfig goes through it to find, reparse and save its files;
+   whatever calls it or creates, reparses, syncs or deletes a KConfig
+   holds this, for contexts driven from different threads. readSetting ()
+   only looks at snapshots and never needs it. Recursive, as they nest. */
+static QMutex &
+kdeDirsLock ()
+{
+    static QMutex lock (QMutex::Recursive);
 
-    {"initiate_key", "scale", "Expose", "kwin", OptionKey},
-    {"initiate_all_key", "scale", "ExposeAll", "kwin", OptionKey},
-    {"expo_key", "expo", "ShowDesktopGrid", "kwin", OptionKey},
+    return lock;
+}
 
-    {"autoraise", CORE_NAME, "AutoRaise", "Windows", OptionBool},
-    {"raise_on_click", CORE_NAME, "ClickRaise", "Windows", OptionBool},
-    {"snapoff_maximized", "move", "MoveResizeMaximizedWindows", "Windows", OptionBool},
-    {"always_show", "resizeinfo", "GeometryTip", "Windows", OptionBool},
-    {"allow_wraparound", "wall", "RollOverDesktops", "Windows", OptionBool},
+/* libcompizconfig keeps the file watches of the process in one table
+   without a lock, our calls that change it hold this instead. It walks
+   the table in ccsProcessEvents () without asking us, so a thread must
+   not process events while another one runs init () or fini (). */
+static QMutex &
+fileWatchLock ()
+{
+    static QMutex lock;
 
-    {"autoraise_delay", CORE_NAME, "AutoRaiseInterval", "Windows", OptionInt},
-    {"flip_time", "rotate", "ElectricBorderDelay", "Windows", OptionInt},
-    {"number_of_desktops", CORE_NAME, "Number", "Desktops", OptionInt},
+    return lock;
+}
 
-    {"unmaximize_window_key", CORE_NAME, NULL, "Windows", OptionSpecial},
-    {"maximize_window_key", CORE_NAME, NULL, "Windows", OptionSpecial},
-    {"maximize_window_horizontally_key", CORE_NAME, NULL, "Windows", OptionSpecial},
-    {"maximize_window_vertically_key", CORE_NAME, NULL, "Windows", OptionSpecial},
-    {"command11", "commands", NULL, "Windows", OptionSpecial},
-    {"click_to_focus", CORE_NAME, NULL, "Windows", OptionSpecial},
-    {"mode", "resize", NULL, "Windows", OptionSpecial},
+static ConfigFiles *
+filesForContext (CCSContext *context)
+{
+    ContextTable &table = contextTable ();
+    ContextFiles *files;
+    ConfigFiles  *cFiles = NULL;
+    int          epoch;
 
-    {"snap_type", "snap", NULL, "Windows", OptionSpecial},
-    {"edges_categories", "snap", NULL, "Windows", OptionSpecial},
-    {"resistance_distance", "snap", NULL, "Windows", OptionSpecial},
-    {"attraction_distance", "snap", NULL, "Windows", OptionSpecial},
+    for (;;)
+    {
+	epoch = table.epoch;
+	table.readers[epoch].ref ();
 
-    {"next_key", "switcher", "Walk Through Windows", "Windows", OptionSpecial},
-    {"prev_key", "switcher", "Walk Through Windows (Reverse)", "Windows", OptionSpecial},
-    {"next_all_key", "switcher", "Walk Through Windows", "Windows", OptionSpecial},
-    {"prev_all_key", "switcher", "Walk Through Windows (Reverse)", "Windows", OptionSpecial},
-    {"next_no_popup_key", "switcher", "Walk Through Windows", "Windows", OptionSpecial},
-    {"prev_no_popup_key", "switcher", "Walk Through Windows (Reverse)", "Windows", OptionSpecial},
+	if (epoch == (int) table.epoch)
+	    break;
 
-    {"edge_flip_pointer", "rotate", "ElectricBorders",  "Windows", OptionSpecial},
-    {"edge_flip_window", "rotate", "ElectricBorders",  "Windows", OptionSpecial},
-    {"edgeflip_pointer", "wall", "ElectricBorders",  "Windows", OptionSpecial},
-    {"edgeflip_move", "wall", "ElectricBorders",  "Windows", OptionSpecial},
+	table.readers[epoch].deref ();
+    }
 
-    {"mode", "place", "Placement",  "Windows", OptionSpecial}
+    files = table.files;
 
-};
+    if (files)
+	cFiles = files->value (context);
 
-#define N_SOPTIONS (sizeof (specialOptions) / sizeof (struct _SpecialOption))
+    table.readers[epoch].deref ();
 
+    return cFiles;
+}
 
+/* with contextFilesLock held, NULL files remove the context */
 static void
-createFile (QString name)
+setFilesForContext (CCSContext  *context,
+		    ConfigFiles *cFiles)
 {
-    if (!QFile::exists(name))
-    {
-	QFile file (name);
-	file.open (QIODevice::WriteOnly | QIODevice::Append);
-	file.close ();
-    }
+    ContextTable &table = contextTable ();
+    ContextFiles *old = table.files;
+    ContextFiles *files = (old) ? new ContextFiles (*old) :
+				  new ContextFiles ();
+
+    if (cFiles)
+	files->insert (context, cFiles);
+    else
+	files->remove (context);
+
+    table.files.fetchAndStoreOrdered (files);
+
+    int epoch = table.epoch;
+
+    table.epoch.fetchAndStoreOrdered (!epoch);
+
+    while (table.readers[epoch] != 0)
+	QThread::yieldCurrentThread ();
+
+    delete old;
 }
 
+/* done on first use rather than in getBackendInfo, which libcompizconfig
+   calls for every backend it merely lists */
 static void
-reload (unsigned int,
-	void     *closure)
+initComponentData ()
 {
-    CCSContext *context = (CCSContext *) closure;
+    QMutexLocker locker (&contextFilesLock ());
 
-    ccsDisableFileWatch (cFiles->mainWatch);
-    ccsDisableFileWatch (cFiles->kwinWatch);
-    ccsDisableFileWatch (cFiles->shortcutWatch);
-    cFiles->main->reparseConfiguration();
-    cFiles->kwin->reparseConfiguration();
-    cFiles->shortcuts->reparseConfiguration();
-    ccsReadSettings (context);
-    ccsEnableFileWatch (cFiles->mainWatch);
-    ccsEnableFileWatch (cFiles->kwinWatch);
-    ccsEnableFileWatch (cFiles->shortcutWatch);
+    if (!KGlobal::hasMainComponent ())
+	KComponentData componentData ("ccs-backend-kconfig4");
 }
 
+typedef struct _InternedName
+{
+    QByteArray name;
+    QString    string;
+}
+InternedName;
 
-static bool
-isIntegratedOption (CCSSetting *setting)
+/* plugin name, screen number or -1 for the display group */
+typedef QPair<const char *, int> GroupId;
+
+typedef struct _InternedGroup
 {
+    QByteArray plugin;
+    QString    group;
+}
+InternedGroup;
 
-    for (unsigned int i = 0; i < N_SOPTIONS; i++)
+/* The libcompizconfig strings of the read path are looked up by address
+   in a cache per thread, so readSetting only takes internTableLock for
+   names the thread has not seen yet. The address is checked against the
+   stored name since it may get reused after a plugin is freed. */
+typedef struct _InternCache
+{
+    QHash<const char *, InternedName> names;
+    QHash<GroupId, InternedGroup>     groups;
+}
+InternCache;
+
+/* the settings of all contexts, counted by init () and fini () */
+static QAtomicInt &
+internCacheSettings ()
+{
+    static QAtomicInt settings;
+
+    return settings;
+}
+
+/* Every setting of every screen has a name and a group of its own, so a
+   cache that holds them all never starts over while the plugins stay
+   loaded; it only fills up with the addresses of freed plugins. */
+static int
+internCacheLimit ()
+{
+    return qMax ((int) internCacheSettings (), INTERN_POINTER_CACHE_SIZE);
+}
+
+static InternCache &
+internCache ()
+{
+    static QThreadStorage<InternCache *> caches;
+
+    if (!caches.hasLocalData ())
+	caches.setLocalData (new InternCache ());
+
+    return *caches.localData ();
+}
+
+static QString
+internName (const char *name)
+{
+    InternCache &cache = internCache ();
+
+    QHash<const char *, InternedName>::const_iterator it =
+	cache.names.constFind (name);
+
+    if (it != cache.names.constEnd () && it.value ().name == name)
+	return it.value ().string;
+
+    if (cache.names.size () >= internCacheLimit ())
+	cache.names.clear ();
+
+    InternedName &entry = cache.names[name];
+
+    entry.name   = name;
+    entry.string = internString (QString::fromUtf8 (name));
+
+    return entry.string;
+}
+
+static QString
+settingGroup (CCSSetting *setting)
+{
+    InternCache &cache = internCache ();
+    const char  *plugin = setting->parent->name;
+    GroupId     id (plugin, (setting->isScreen) ? setting->screenNum : -1);
+
+    QHash<GroupId, InternedGroup>::const_iterator it =
+	cache.groups.constFind (id);
+
+    if (it != cache.groups.constEnd () && it.value ().plugin == plugin)
+	return it.value ().group;
+
+    QString group = QString::fromUtf8 (plugin);
+
+    if (setting->isScreen)
     {
-	if (setting->name == specialOptions[i].settingName &&
-	    QString (setting->parent->name) == specialOptions[i].pluginName)
-		return true;
+	group += "_screen";
+	group += QString::number (setting->screenNum);
     }
+    else
+	group += "_display";
 
-    return false;
+    if (cache.groups.size () >= internCacheLimit ())
+	cache.groups.clear ();
+
+    InternedGroup &entry = cache.groups[id];
+
+    entry.plugin = plugin;
+    entry.group  = internString (group);
+
+    return entry.group;
 }
 
-static void
-KdeIntToCCS (CCSSetting   *setting,
-	     int          num)
+static ProfileSnapshot *
+buildSnapshot (KConfig *config)
 {
-    int val = cFiles->kwin->group (specialOptions[num].groupName).
-	       readEntry (specialOptions[num].kdeName,
-			  setting->defaultValue.value.asInt);
+    ProfileSnapshot *snapshot = new ProfileSnapshot ();
+
+    snapshot->ref = 1;
+
+    foreach (const QString &group, config->groupList ())
+    {
+	QMap<QString, QString>                 entries =
+	    config->group (group).entryMap ();
+	QMap<QString, QString>::const_iterator it;
+	GroupEntries                           &values =
+	    snapshot->entries[internString (group)];
+
+	for (it = entries.constBegin (); it != entries.constEnd (); it++)
+	    values.insert (internString (it.key ()), it.value ().toUtf8 ());
+    }
 
-    ccsSetInt (setting, val);
+    return snapshot;
 }
 
-static void
-KdeBoolToCCS (CCSSetting   *setting,
-	      int          num)
+static bool
+readIniFile (const QString       &path,
+	     const QSet<QString> *wanted,
+	     ProfileEntries      &entries)
 {
-    Bool val = (cFiles->kwin->group (specialOptions[num].groupName).
-		readEntry (specialOptions[num].kdeName,
-			   (setting->defaultValue.value.asBool)?
-		true: false))? TRUE : FALSE;
+    QFile      f (path);
+    QByteArray buffer;
 
-    ccsSetBool (setting, val);
+    if (!f.open (QIODevice::ReadOnly))
+	return false;
+
+    qint64     size = f.size ();
+    const char *data = (size > 0) ? (const char *) f.map (0, size) : NULL;
+
+    if (size > 0 && !data)
+    {
+	buffer = f.readAll ();
+	data   = buffer.constData ();
+	size   = buffer.size ();
+    }
+
+    bool parsed = parseIni (data, size, wanted, entries);
+
+    if (size > 0 && buffer.isEmpty ())
+	f.unmap ((uchar *) data);
+
+    return parsed;
 }
 
-static void
-KdeKeyToCCS (CCSSetting   *setting,
-	     int          num)
+/* builds a snapshot straight from the profile file without KConfig,
+   NULL if KConfig has to read it */
+static ProfileSnapshot *
+parseProfileFile (const QString &path)
 {
-    CCSSettingKeyValue keySet;
-    keySet.keysym     = 0;
-    keySet.keyModMask = 0;
+    ProfileSnapshot *snapshot = new ProfileSnapshot ();
 
-    QStringList keyData = cFiles->shortcuts->
-	group (specialOptions[num].groupName).
-	readEntry (specialOptions[num].kdeName, QStringList());
+    snapshot->ref = 1;
 
-    if (keyData.size () != 3)
-	return;
-    
-    int key = QKeySequence(keyData[0].split (' ')[0])[0];
+    if (!readIniFile (path, NULL, snapshot->entries))
+    {
+	delete snapshot;
+	return NULL;
+    }
 
-    int kdeKeymod = 0;
+    return snapshot;
+}
+
+/* the snapshot holds raw entries, decode them the way KConfigGroup does */
+static bool
+entryToBool (const QByteArray &entry)
+{
+    QByteArray lower = entry.toLower ();
+
+    return !(lower == "false" || lower == "no" ||
+	     lower == "off" || lower == "0");
+}
+
+static bool
+listEntryToBool (const QByteArray &entry)
+{
+    return !(entry.isEmpty () || entry == "0" ||
+	     entry.toLower () == "false");
+}
+
+/* Splits a KConfig list entry the way KConfigGroup does, one element per
+   call; pos starts at 0 and is -1 once the last element was returned. */
+static bool
+nextListElement (const QByteArray &entry,
+		 int              &pos,
+		 QByteArray       &element)
+{
+    if (pos < 0 || (pos == 0 && entry.isEmpty ()))
+	return false;
+
+    element.truncate (0);
+
+    if (pos == 0 && entry == "\\0")
+    {
+	pos = -1;
+	return true;
+    }
+
+    for (; pos < entry.size (); pos++)
+    {
+	char c = entry[pos];
+
+	if (c == '\\')
+	{
+	    if (++pos < entry.size ())
+		element += entry[pos];
+	}
+	else if (c == ',')
+	{
+	    pos++;
+	    return true;
+	}
+	else
+	    element += c;
+    }
+
+    pos = -1;
+
+    return true;
+}
+
+/* the system files first, so that the user's file wins; KConfig reads
+   the whole cascade if any file has something parseIni () does not
+   handle, the kiosk markers it applies across files in particular */
+static void
+loadKdeFile (KdeFile *kf)
+{
+    QMutexLocker locker (&kdeDirsLock ());
+    QStringList  files = KGlobal::dirs ()->findAllResources ("config",
+							     kf->name);
+
+    kf->entries.clear ();
+    kf->kiosk = false;
+
+    for (int i = files.size () - 1; i >= 0 && !kf->kiosk; i--)
+	kf->kiosk = !readIniFile (files[i], &kf->groups, kf->entries);
+
+    if (!kf->kiosk)
+	return;
+
+    KConfig config (kf->name, KConfig::NoGlobals);
+
+    kf->entries.clear ();
+
+    foreach (const QString &group, kf->groups)
+    {
+	KConfigGroup g = config.group (group);
+
+	if (!g.exists ())
+	    continue;
+
+	GroupEntries &values = kf->entries[internString (group)];
+
+	/* readEntry () does the [$e] expansion */
+	foreach (const QString &key, g.keyList ())
+	    values.insert (internString (key),
+			   g.readEntry (key, QString ()).toUtf8 ());
+    }
+}
+
+static const QByteArray *
+kdeEntry (const KdeFile *kf,
+	  const QString &group,
+	  const QString &key)
+{
+    ProfileEntries::const_iterator g = kf->entries.constFind (group);
+
+    if (g == kf->entries.constEnd ())
+	return NULL;
+
+    GroupEntries::const_iterator e = g->constFind (key);
+
+    return (e != g->constEnd ()) ? &e.value () : NULL;
+}
+
+static int
+entryToInt (const QByteArray &entry,
+	    int              defaultValue)
+{
+    bool ok;
+    int  value = entry.trimmed ().toInt (&ok);
+
+    return (ok) ? value : defaultValue;
+}
+
+static QStringList
+entryToStringList (const QByteArray &entry)
+{
+    QStringList list;
+    QByteArray  element;
+    int         pos = 0;
+
+    while (nextListElement (entry, pos, element))
+	list.append (QString::fromUtf8 (element));
+
+    return list;
+}
+
+static int
+readKdeInt (const KdeFile *kf,
+	    const QString &group,
+	    const QString &key,
+	    int           defaultValue)
+{
+    const QByteArray *entry = kdeEntry (kf, group, key);
+
+    return (entry) ? entryToInt (*entry, defaultValue) : defaultValue;
+}
+
+static QString
+readKdeString (const KdeFile *kf,
+	       const QString &group,
+	       const QString &key)
+{
+    const QByteArray *entry = kdeEntry (kf, group, key);
+
+    return (entry) ? QString::fromUtf8 (*entry) : QString ();
+}
+
+static QStringList
+readKdeList (const KdeFile *kf,
+	     const QString &group,
+	     const QString &key)
+{
+    const QByteArray *entry = kdeEntry (kf, group, key);
+
+    return (entry) ? entryToStringList (*entry) : QStringList ();
+}
+
+/* writes source with the dirty entries spliced in to target, through a
+   temporary file that is on disk before it replaces target, so that
+   nobody reads it half written and a crash leaves one or the other */
+static bool
+saveIniFile (const QString                        &source,
+	     const QString                        &target,
+	     const ProfileEntries                 &entries,
+	     const QHash<QString, QSet<QString> > &dirty)
+{
+    QFile      in (source);
+    QByteArray data;
+
+    if (in.open (QIODevice::ReadOnly))
+	data = in.readAll ();
+    else if (in.exists ())
+	return false;
+
+    QString    temp = target + ".ccs-new";
+    QFile      out (temp);
+    QByteArray spliced;
+
+    if (!spliceIni (data, entries, dirty, spliced))
+	return false;
+
+    if (!out.open (QIODevice::WriteOnly | QIODevice::Truncate))
+	return false;
+
+    if (in.exists ())
+	out.setPermissions (in.permissions ());
+
+    if (out.write (spliced) != spliced.size () || !out.flush () ||
+	fdatasync (out.handle ()))
+    {
+	out.close ();
+	QFile::remove (temp);
+	return false;
+    }
+
+    out.close ();
+
+    if (rename (QFile::encodeName (temp).constData (),
+		QFile::encodeName (target).constData ()))
+    {
+	QFile::remove (temp);
+	return false;
+    }
+
+    return true;
+}
+
+#ifdef HAVE_PROFILE_STORE
+static ProfileStore *
+openStore (const QString &path)
+{
+    static QAtomicInt ids;
+    ProfileStore      *store = new ProfileStore;
+
+    /* unique even while the store of a previous profile is still read */
+    store->ref        = 1;
+    store->connection = QString ("ccs-backend-kconfig4-%1").
+			arg (ids.fetchAndAddOrdered (1));
+    store->path       = path;
+
+    {
+	QSqlDatabase db = QSqlDatabase::addDatabase ("QSQLITE",
+						     store->connection);
+
+	db.setDatabaseName (path);
+
+	if (db.open ())
+	{
+	    QSqlQuery query (db);
+
+	    if (query.exec ("CREATE TABLE IF NOT EXISTS entries ("
+			    "grp TEXT NOT NULL, key TEXT NOT NULL, "
+			    "value BLOB, PRIMARY KEY (grp, key))"))
+		return store;
+	}
+
+	kWarning () << "Could not open" << path << ":" <<
+		       db.lastError ().text () << endl;
+    }
+
+    QSqlDatabase::removeDatabase (store->connection);
+    delete store;
+
+    return NULL;
+}
+
+/* whoever drops the last reference closes the connections of every
+   thread, none of them is in use by then */
+static void
+releaseStore (ProfileStore *store)
+{
+    if (!store || store->ref.deref ())
+	return;
+
+    {
+	QSqlDatabase db = QSqlDatabase::database (store->connection, false);
+
+	db.close ();
+    }
+
+    QSqlDatabase::removeDatabase (store->connection);
+
+    foreach (const QString &connection, store->readers)
+	QSqlDatabase::removeDatabase (connection);
+
+    delete store;
+}
+
+/* A connection may only be used by the thread that opened it, so every
+   thread reading from a store opens its own the first time; a thread
+   drops the readers of gone stores once it has too many. */
+static StoreReader &
+storeReader (ProfileStore *store)
+{
+    static QThreadStorage<QHash<QString, StoreReader> *> readers;
+
+    if (!readers.hasLocalData ())
+	readers.setLocalData (new QHash<QString, StoreReader> ());
+
+    QHash<QString, StoreReader> *local = readers.localData ();
+
+    QHash<QString, StoreReader>::iterator it =
+	local->find (store->connection);
+
+    if (it != local->end ())
+	return it.value ();
+
+    if (local->size () >= STORE_READER_LIMIT)
+	local->clear ();
+
+    static QAtomicInt ids;
+    StoreReader       &reader = (*local)[store->connection];
+
+    reader.connection = QString ("%1-reader-%2").arg (store->connection).
+			arg (ids.fetchAndAddOrdered (1));
+    reader.generation = 0;
+
+    {
+	QMutexLocker locker (&store->readersLock);
+
+	store->readers.append (reader.connection);
+    }
+
+    QSqlDatabase db = QSqlDatabase::addDatabase ("QSQLITE",
+						 reader.connection);
+
+    /* wait for a write in progress rather than failing the read */
+    db.setConnectOptions ("QSQLITE_BUSY_TIMEOUT=" STORE_BUSY_TIMEOUT);
+    db.setDatabaseName (store->path);
+
+    if (!db.open ())
+	kWarning () << "Could not open" << store->path << ":" <<
+		       db.lastError ().text () << endl;
+
+    return reader;
+}
+
+/* one group per query, so reading a setting never touches the rest of
+   the profile; kept by the reading thread for as long as the snapshot
+   it read them for is current */
+static GroupEntries
+storeGroup (const ProfileSnapshot *snapshot,
+	    const QString         &group)
+{
+    StoreReader &reader = storeReader (snapshot->store);
+
+    if (reader.generation != snapshot->generation)
+    {
+	reader.groups.clear ();
+	reader.generation = snapshot->generation;
+    }
+
+    QHash<QString, GroupEntries>::const_iterator it =
+	reader.groups.constFind (group);
+
+    if (it != reader.groups.constEnd ())
+	return it.value ();
+
+    GroupEntries entries;
+    QSqlQuery    query (QSqlDatabase::database (reader.connection, false));
+
+    query.prepare ("SELECT key, value FROM entries WHERE grp = ?");
+    query.addBindValue (group);
+
+    if (!query.exec ())
+    {
+	kWarning () << "Could not read" << group << "from" <<
+		       snapshot->store->path << endl;
+	return entries;
+    }
+
+    while (query.next ())
+	entries.insert (query.value (0).toString (),
+			query.value (1).toByteArray ());
+
+    reader.groups.insert (group, entries);
+
+    return entries;
+}
+
+/* copies every entry of the INI file at path into the store */
+static bool
+importStore (ProfileStore  *store,
+	     const QString &path)
+{
+    QMutexLocker locker (&kdeDirsLock ());
+
+    KConfig      ini (path, KConfig::SimpleConfig);
+    QSqlDatabase db = QSqlDatabase::database (store->connection, false);
+    QSqlQuery    query (db);
+
+    if (!db.transaction ())
+	return false;
+
+    query.prepare ("INSERT OR REPLACE INTO entries (grp, key, value) "
+		   "VALUES (?, ?, ?)");
+
+    foreach (const QString &group, ini.groupList ())
+    {
+	QMap<QString, QString>                 entries =
+	    ini.group (group).entryMap ();
+	QMap<QString, QString>::const_iterator it;
+
+	for (it = entries.constBegin (); it != entries.constEnd (); it++)
+	{
+	    query.bindValue (0, group);
+	    query.bindValue (1, it.key ());
+	    query.bindValue (2, it.value ().toUtf8 ());
+
+	    if (!query.exec ())
+	    {
+		db.rollback ();
+		return false;
+	    }
+	}
+    }
+
+    return db.commit ();
+}
+
+/* writes every entry of the store into the INI file at path */
+static bool
+exportStore (ProfileStore  *store,
+	     const QString &path)
+{
+    QMutexLocker locker (&kdeDirsLock ());
+
+    KConfig   ini (path, KConfig::SimpleConfig);
+    QSqlQuery query (QSqlDatabase::database (store->connection, false));
+
+    if (!query.exec ("SELECT grp, key, value FROM entries"))
+	return false;
+
+    while (query.next ())
+	ini.group (query.value (0).toString ()).
+	    writeEntry (query.value (1).toString (),
+			QString::fromUtf8 (query.value (2).toByteArray ()));
+
+    ini.sync ();
+
+    return true;
+}
+
+/* the file change counter of the header, bumped by every commit */
+static QByteArray
+storeGeneration (ProfileStore *store)
+{
+    QFile f (store->path);
+
+    if (!f.open (QIODevice::ReadOnly))
+	return QByteArray ();
+
+    return f.read (28).mid (24);
+}
+#else
+/* built without QtSql, every profile stays an INI file and no store is
+   ever open, so only openStore () gets called */
+static ProfileStore *
+openStore (const QString &path)
+{
+    kWarning () << "Built without SQLite profile storage, cannot open" <<
+		   path << endl;
+
+    return NULL;
+}
+
+static void
+releaseStore (ProfileStore *)
+{
+}
+
+static GroupEntries
+storeGroup (const ProfileSnapshot *,
+	    const QString         &)
+{
+    return GroupEntries ();
+}
+
+static bool
+importStore (ProfileStore  *,
+	     const QString &)
+{
+    return false;
+}
+
+static bool
+exportStore (ProfileStore  *,
+	     const QString &)
+{
+    return false;
+}
+
+static QByteArray
+storeGeneration (ProfileStore *)
+{
+    return QByteArray ();
+}
+#endif
+
+static QString
+profileConfigName (const QString &profile)
+{
+    if (profile.isEmpty ())
+	return "compizrc";
+
+    return "compizrc." + profile;
+}
+
+/* per profile backend options live in a "Profile <name>" group */
+static QString
+profileOptionsGroup (const QString &profile)
+{
+    return "Profile " + ((profile.isEmpty ()) ? QString ("Default") : profile);
+}
+
+static bool
+profileUsesStore (const QString &profile)
+{
+    QMutexLocker locker (&kdeDirsLock ());
+
+    KConfig      options ("ccs-backend-kconfig4rc", KConfig::SimpleConfig);
+    KConfigGroup group = options.group (profileOptionsGroup (profile));
+
+    return group.readEntry ("Storage", QString ()) == "SQLite";
+}
+
+static QString
+profileParent (KConfig       &options,
+	       const QString &profile)
+{
+    QString parent = options.group (profileOptionsGroup (profile)).
+		     readEntry ("Parent", QString ());
+
+    return (parent == "Default") ? QString () : parent;
+}
+
+static bool
+profileHasParent (KConfig       &options,
+		  const QString &profile)
+{
+    return options.group (profileOptionsGroup (profile)).hasKey ("Parent");
+}
+
+/* INI files of the parent chain of profile, most general first */
+static QStringList
+profileLayers (const QString &configDir,
+	       const QString &profile)
+{
+    QMutexLocker locker (&kdeDirsLock ());
+
+    KConfig       options ("ccs-backend-kconfig4rc", KConfig::SimpleConfig);
+    QStringList   layers;
+    QSet<QString> seen;
+    QString       name = profile;
+
+    seen.insert (name);
+
+    while (profileHasParent (options, name))
+    {
+	name = profileParent (options, name);
+
+	if (seen.contains (name))
+	{
+	    kWarning () << "Profile" << profile << "has a parent loop" << endl;
+	    break;
+	}
+
+	seen.insert (name);
+	layers.prepend (configDir + profileConfigName (name));
+    }
+
+    return layers;
+}
+
+typedef enum
+{
+    OptionInt,
+    OptionBool,
+    OptionKey,
+    OptionSpecial
+}
+SpecialOptionType;
+
+/* plain literals only, so the tables are laid out by the compiler and
+   loading the backend to query its info runs no constructors */
+struct _SpecialOption
+{
+    const char        *settingName;
+    const char        *pluginName;
+    const char        *kdeName;
+    const char        *groupName;
+    SpecialOptionType type;
+}
+
+const specialOptions[] =
+{
+    {"close_window_key", CORE_NAME, "Window Close", "kwin", OptionKey},
+    {"lower_window_key", CORE_NAME, "Window Lower", "kwin", OptionKey},
+    {"toggle_window_maximized_key", CORE_NAME, "Window Maximize", "kwin", OptionKey},
+    {"minimize_window_key", CORE_NAME, "Window Minimize", "kwin", OptionKey},
+    {"toggle_window_maximized_horizontally_key", CORE_NAME, "Window Maximize Horizontal", "kwin", OptionKey},
+    {"toggle_window_maximized_vertically_key", CORE_NAME, "Window Maximize Vertical", "kwin", OptionKey},
+    {"window_menu_key", CORE_NAME, "Window Operations Menu", "kwin", OptionKey},
+    
+    {"toggle_window_shaded_key", CORE_NAME, "Window Shade", "kwin", OptionKey},
+    {"raise_window_key", CORE_NAME, "Window Raise", "kwin", OptionKey},
+    {"toggle_window_fullscreen_key", CORE_NAME, "Window Fullscreen", "kwin", OptionKey},
+    {"run_command11_key", "commands", "Kill Window", "kwin", OptionKey},
+    {"initiate_key", "move", "Window Move", "kwin", OptionKey},
+    {"initiate_key", "resize", "Window Resize", "kwin", OptionKey},
+    {"rotate_right_key", "rotate", "Switch to Next Desktop", "kwin", OptionKey},
+    {"rotate_left_key", "rotate", "Switch to Previous Desktop", "kwin", OptionKey},
+    {"rotate_to_1_key", "rotate", "Switch to Desktop 1", "kwin", OptionKey},
+    {"rotate_to_2_key", "rotate", "Switch to Desktop 2", "kwin", OptionKey},
+    {"rotate_to_3_key", "rotate", "Switch to Desktop 3", "kwin", OptionKey},
+    {"rotate_to_4_key", "rotate", "Switch to Desktop 4", "kwin", OptionKey},
+    {"rotate_to_5_key", "rotate", "Switch to Desktop 5", "kwin", OptionKey},
+    {"rotate_to_6_key", "rotate", "Switch to Desktop 6", "kwin", OptionKey},
+    {"rotate_to_7_key", "rotate", "Switch to Desktop 7", "kwin", OptionKey},
+    {"rotate_to_8_key", "rotate", "Switch to Desktop 8", "kwin", OptionKey},
+    {"rotate_to_9_key", "rotate", "Switch to Desktop 9", "kwin", OptionKey},
+    {"rotate_to_10_key", "rotate", "Switch to Desktop 10", "kwin", OptionKey},
+    {"rotate_to_11_key", "rotate", "Switch to Desktop 11", "kwin", OptionKey},
+    {"rotate_to_12_key", "rotate", "Switch to Desktop 12", "kwin", OptionKey},
+    {"rotate_right_window_key", "rotate", "Window to Next Desktop", "kwin", OptionKey},
+    {"rotate_left_window_key", "rotate", "Window to Previous Desktop", "kwin", OptionKey},
+    {"rotate_to_1_window_key", "rotate", "Window to Desktop 1", "kwin", OptionKey},
+    {"rotate_to_2_window_key", "rotate", "Window to Desktop 2", "kwin", OptionKey},
+    {"rotate_to_3_window_key", "rotate", "Window to Desktop 3", "kwin", OptionKey},
+    {"rotate_to_4_window_key", "rotate", "Window to Desktop 4", "kwin", OptionKey},
+    {"rotate_to_5_window_key", "rotate", "Window to Desktop 5", "kwin", OptionKey},
+    {"rotate_to_6_window_key", "rotate", "Window to Desktop 6", "kwin", OptionKey},
+    {"rotate_to_7_window_key", "rotate", "Window to Desktop 7", "kwin", OptionKey},
+    {"rotate_to_8_window_key", "rotate", "Window to Desktop 8", "kwin", OptionKey},
+    {"rotate_to_9_window_key", "rotate", "Window to Desktop 9", "kwin", OptionKey},
+    {"rotate_to_10_window_key", "rotate", "Window to Desktop 10", "kwin", OptionKey},
+    {"rotate_to_11_window_key", "rotate", "Window to Desktop 11", "kwin", OptionKey},
+    {"rotate_to_12_window_key", "rotate", "Window to Desktop 12", "kwin", OptionKey},
+
+    {"next_key", "wall", "Switch to Next Desktop", "kwin", OptionKey},
+    {"prev_key", "wall", "Switch to Previous Desktop", "kwin", OptionKey},
+    {"right_window_key", "wall", "Window One Desktop to the Right", "kwin", OptionKey},
+    {"left_window_key", "wall", "Window One Desktop to the Left", "kwin", OptionKey},
+    {"up_window_key", "wall", "Window One Desktop Up", "kwin", OptionKey},
+    {"down_window_key", "wall", "Window One Desktop Down", "kwin", OptionKey},
+    {"up_key", "wall", "Switch One Desktop Up", "kwin", OptionKey},
+    {"down_key", "wall", "Switch One Desktop Down", "kwin", OptionKey},
+    {"left_key", "wall", "Switch One Desktop to the Left", "kwin", OptionKey},
+    {"right_key", "wall", "Switch One Desktop to the Right", "kwin", OptionKey},
+
+    {"switch_to_1_key", "vpswitch", "Switch to Desktop 1", "kwin", OptionKey},
+    {"switch_to_2_key", "vpswitch", "Switch to Desktop 2", "kwin", OptionKey},
+    {"switch_to_3_key", "vpswitch", "Switch to Desktop 3", "kwin", OptionKey},
+    {"switch_to_4_key", "vpswitch", "Switch to Desktop 4", "kwin", OptionKey},
+    {"switch_to_5_key", "vpswitch", "Switch to Desktop 5", "kwin", OptionKey},
+    {"switch_to_6_key", "vpswitch", "Switch to Desktop 6", "kwin", OptionKey},
+    {"switch_to_7_key", "vpswitch", "Switch to Desktop 7", "kwin", OptionKey},
+    {"switch_to_8_key", "vpswitch", "Switch to Desktop 8", "kwin", OptionKey},
+    {"switch_to_9_key", "vpswitch", "Switch to Desktop 9", "kwin", OptionKey},
+    {"switch_to_10_key", "vpswitch", "Switch to Desktop 10", "kwin", OptionKey},
+    {"switch_to_11_key", "vpswitch", "Switch to Desktop 11", "kwin", OptionKey},
+    {"switch_to_12_key", "vpswitch", "Switch to Desktop 12", "kwin", OptionKey},
+
+    {"initiate_key", "scale", "Expose", "kwin", OptionKey},
+    {"initiate_all_key", "scale", "ExposeAll", "kwin", OptionKey},
+    {"expo_key", "expo", "ShowDesktopGrid", "kwin", OptionKey},
+
+    {"autoraise", CORE_NAME, "AutoRaise", "Windows", OptionBool},
+    {"raise_on_click", CORE_NAME, "ClickRaise", "Windows", OptionBool},
+    {"snapoff_maximized", "move", "MoveResizeMaximizedWindows", "Windows", OptionBool},
+    {"always_show", "resizeinfo", "GeometryTip", "Windows", OptionBool},
+    {"allow_wraparound", "wall", "RollOverDesktops", "Windows", OptionBool},
+
+    {"autoraise_delay", CORE_NAME, "AutoRaiseInterval", "Windows", OptionInt},
+    {"flip_time", "rotate", "ElectricBorderDelay", "Windows", OptionInt},
+    {"number_of_desktops", CORE_NAME, "Number", "Desktops", OptionInt},
+
+    {"unmaximize_window_key", CORE_NAME, NULL, "Windows", OptionSpecial},
+    {"maximize_window_key", CORE_NAME, NULL, "Windows", OptionSpecial},
+    {"maximize_window_horizontally_key", CORE_NAME, NULL, "Windows", OptionSpecial},
+    {"maximize_window_vertically_key", CORE_NAME, NULL, "Windows", OptionSpecial},
+    {"command11", "commands", NULL, "Windows", OptionSpecial},
+    {"click_to_focus", CORE_NAME, NULL, "Windows", OptionSpecial},
+    {"mode", "resize", NULL, "Windows", OptionSpecial},
+
+    {"snap_type", "snap", NULL, "Windows", OptionSpecial},
+    {"edges_categories", "snap", NULL, "Windows", OptionSpecial},
+    {"resistance_distance", "snap", NULL, "Windows", OptionSpecial},
+    {"attraction_distance", "snap", NULL, "Windows", OptionSpecial},
+
+    {"next_key", "switcher", "Walk Through Windows", "Windows", OptionSpecial},
+    {"prev_key", "switcher", "Walk Through Windows (Reverse)", "Windows", OptionSpecial},
+    {"next_all_key", "switcher", "Walk Through Windows", "Windows", OptionSpecial},
+    {"prev_all_key", "switcher", "Walk Through Windows (Reverse)", "Windows", OptionSpecial},
+    {"next_no_popup_key", "switcher", "Walk Through Windows", "Windows", OptionSpecial},
+    {"prev_no_popup_key", "switcher", "Walk Through Windows (Reverse)", "Windows", OptionSpecial},
+
+    {"edge_flip_pointer", "rotate", "ElectricBorders",  "Windows", OptionSpecial},
+    {"edge_flip_window", "rotate", "ElectricBorders",  "Windows", OptionSpecial},
+    {"edgeflip_pointer", "wall", "ElectricBorders",  "Windows", OptionSpecial},
+    {"edgeflip_move", "wall", "ElectricBorders",  "Windows", OptionSpecial},
+
+    {"mode", "place", "Placement",  "Windows", OptionSpecial}
+
+};
+
+#define N_SOPTIONS (sizeof (specialOptions) / sizeof (struct _SpecialOption))
+
+/* the specialOptions rows in strcmp order of setting, then plugin name,
+   for findSpecialOption () to bisect; a row added above goes in here too */
+struct _SpecialOptionIndex
+{
+    const char    *settingName;
+    const char    *pluginName;
+    unsigned char option;
+}
+
+const specialOptionIndex[] =
+{
+    {"allow_wraparound", "wall", 70},
+    {"always_show", "resizeinfo", 69},
+    {"attraction_distance", "snap", 84},
+    {"autoraise", CORE_NAME, 66},
+    {"autoraise_delay", CORE_NAME, 71},
+    {"click_to_focus", CORE_NAME, 79},
+    {"close_window_key", CORE_NAME, 0},
+    {"command11", "commands", 78},
+    {"down_key", "wall", 48},
+    {"down_window_key", "wall", 46},
+    {"edge_flip_pointer", "rotate", 91},
+    {"edge_flip_window", "rotate", 92},
+    {"edgeflip_move", "wall", 94},
+    {"edgeflip_pointer", "wall", 93},
+    {"edges_categories", "snap", 82},
+    {"expo_key", "expo", 65},
+    {"flip_time", "rotate", 72},
+    {"initiate_all_key", "scale", 64},
+    {"initiate_key", "move", 11},
+    {"initiate_key", "resize", 12},
+    {"initiate_key", "scale", 63},
+    {"left_key", "wall", 49},
+    {"left_window_key", "wall", 44},
+    {"lower_window_key", CORE_NAME, 1},
+    {"maximize_window_horizontally_key", CORE_NAME, 76},
+    {"maximize_window_key", CORE_NAME, 75},
+    {"maximize_window_vertically_key", CORE_NAME, 77},
+    {"minimize_window_key", CORE_NAME, 3},
+    {"mode", "place", 95},
+    {"mode", "resize", 80},
+    {"next_all_key", "switcher", 87},
+    {"next_key", "switcher", 85},
+    {"next_key", "wall", 41},
+    {"next_no_popup_key", "switcher", 89},
+    {"number_of_desktops", CORE_NAME, 73},
+    {"prev_all_key", "switcher", 88},
+    {"prev_key", "switcher", 86},
+    {"prev_key", "wall", 42},
+    {"prev_no_popup_key", "switcher", 90},
+    {"raise_on_click", CORE_NAME, 67},
+    {"raise_window_key", CORE_NAME, 8},
+    {"resistance_distance", "snap", 83},
+    {"right_key", "wall", 50},
+    {"right_window_key", "wall", 43},
+    {"rotate_left_key", "rotate", 14},
+    {"rotate_left_window_key", "rotate", 28},
+    {"rotate_right_key", "rotate", 13},
+    {"rotate_right_window_key", "rotate", 27},
+    {"rotate_to_10_key", "rotate", 24},
+    {"rotate_to_10_window_key", "rotate", 38},
+    {"rotate_to_11_key", "rotate", 25},
+    {"rotate_to_11_window_key", "rotate", 39},
+    {"rotate_to_12_key", "rotate", 26},
+    {"rotate_to_12_window_key", "rotate", 40},
+    {"rotate_to_1_key", "rotate", 15},
+    {"rotate_to_1_window_key", "rotate", 29},
+    {"rotate_to_2_key", "rotate", 16},
+    {"rotate_to_2_window_key", "rotate", 30},
+    {"rotate_to_3_key", "rotate", 17},
+    {"rotate_to_3_window_key", "rotate", 31},
+    {"rotate_to_4_key", "rotate", 18},
+    {"rotate_to_4_window_key", "rotate", 32},
+    {"rotate_to_5_key", "rotate", 19},
+    {"rotate_to_5_window_key", "rotate", 33},
+    {"rotate_to_6_key", "rotate", 20},
+    {"rotate_to_6_window_key", "rotate", 34},
+    {"rotate_to_7_key", "rotate", 21},
+    {"rotate_to_7_window_key", "rotate", 35},
+    {"rotate_to_8_key", "rotate", 22},
+    {"rotate_to_8_window_key", "rotate", 36},
+    {"rotate_to_9_key", "rotate", 23},
+    {"rotate_to_9_window_key", "rotate", 37},
+    {"run_command11_key", "commands", 10},
+    {"snap_type", "snap", 81},
+    {"snapoff_maximized", "move", 68},
+    {"switch_to_10_key", "vpswitch", 60},
+    {"switch_to_11_key", "vpswitch", 61},
+    {"switch_to_12_key", "vpswitch", 62},
+    {"switch_to_1_key", "vpswitch", 51},
+    {"switch_to_2_key", "vpswitch", 52},
+    {"switch_to_3_key", "vpswitch", 53},
+    {"switch_to_4_key", "vpswitch", 54},
+    {"switch_to_5_key", "vpswitch", 55},
+    {"switch_to_6_key", "vpswitch", 56},
+    {"switch_to_7_key", "vpswitch", 57},
+    {"switch_to_8_key", "vpswitch", 58},
+    {"switch_to_9_key", "vpswitch", 59},
+    {"toggle_window_fullscreen_key", CORE_NAME, 9},
+    {"toggle_window_maximized_horizontally_key", CORE_NAME, 4},
+    {"toggle_window_maximized_key", CORE_NAME, 2},
+    {"toggle_window_maximized_vertically_key", CORE_NAME, 5},
+    {"toggle_window_shaded_key", CORE_NAME, 7},
+    {"unmaximize_window_key", CORE_NAME, 74},
+    {"up_key", "wall", 47},
+    {"up_window_key", "wall", 45},
+    {"window_menu_key", CORE_NAME, 6}
+};
+
+#define N_SINDEX (sizeof (specialOptionIndex) / \
+		  sizeof (struct _SpecialOptionIndex))
+
+/* fails to compile when a row is missing from the index */
+typedef char specialOptionIndexComplete[(N_SINDEX == N_SOPTIONS) ? 1 : -1];
+
+/* kwinrc "Windows" keys that OptionSpecial rows are derived from */
+struct _SpecialDependency
+{
+    const char *settingName;
+    const char *pluginName;
+    const char *kdeName;
+}
+
+const specialDependencies[] =
+{
+    {"click_to_focus", CORE_NAME, "FocusPolicy"},
+    {"mode", "resize", "ResizeMode"},
+
+    {"edges_categories", "snap", "WindowSnapZone"},
+    {"edges_categories", "snap", "BorderSnapZone"},
+    {"resistance_distance", "snap", "WindowSnapZone"},
+    {"resistance_distance", "snap", "BorderSnapZone"},
+    {"attraction_distance", "snap", "WindowSnapZone"},
+    {"attraction_distance", "snap", "BorderSnapZone"},
+
+    {"edge_flip_pointer", "rotate", "ElectricBorders"},
+    {"edge_flip_window", "rotate", "ElectricBorders"},
+    {"edgeflip_pointer", "wall", "ElectricBorders"},
+    {"edgeflip_move", "wall", "ElectricBorders"},
+
+    {"mode", "place", "Placement"}
+};
+
+#define N_SDEPENDENCIES (sizeof (specialDependencies) / \
+			 sizeof (struct _SpecialDependency))
+
+static int
+findSpecialOption (CCSSetting *setting)
+{
+    int low  = 0;
+    int high = N_SINDEX - 1;
+
+    while (low <= high)
+    {
+	int mid = (low + high) / 2;
+	int cmp = strcmp (setting->name, specialOptionIndex[mid].settingName);
+
+	if (!cmp)
+	    cmp = strcmp (setting->parent->name,
+			  specialOptionIndex[mid].pluginName);
+
+	if (cmp < 0)
+	    high = mid - 1;
+	else if (cmp > 0)
+	    low = mid + 1;
+	else
+	    return specialOptionIndex[mid].option;
+    }
+
+    return -1;
+}
+
+static inline bool
+optionNameIs (int        option,
+	      const char *settingName)
+{
+    return !strcmp (specialOptions[option].settingName, settingName);
+}
+
+static inline bool
+optionPluginIs (int        option,
+		const char *pluginName)
+{
+    return !strcmp (specialOptions[option].pluginName, pluginName);
+}
+
+/* (group, key) of a KDE file -> specialOptions rows reading it */
+typedef QPair<QString, QString>     KdeKey;
+typedef QHash<KdeKey, QList<int> > KdeKeyIndex;
+typedef QHash<KdeKey, QString>      KdeValues;
+
+/* every KDE key the integrated settings read, built again whenever the
+   KDE files change and handed to readers with the snapshot */
+typedef struct _KdeOptionValue
+{
+    bool        present;
+    int         asInt;
+    QStringList asKey;
+}
+KdeOptionValue;
+
+struct _KdeIntegration
+{
+    QAtomicInt     ref;
+
+    /* OptionInt, OptionBool and OptionKey rows, by specialOptions index */
+    KdeOptionValue options[N_SOPTIONS];
+
+    /* kwinrc "Windows" keys the OptionSpecial rows are derived from */
+    QString        focusPolicy;
+    QString        resizeMode;
+    QString        placement;
+    int            windowSnapZone;
+    int            borderSnapZone;
+    int            electricBorders;
+};
+
+static void
+releaseKdeIntegration (KdeIntegration *ki)
+{
+    if (ki && !ki->ref.deref ())
+	delete ki;
+}
+
+static void
+invalidateKdeIntegration (ConfigFiles *cFiles)
+{
+    releaseKdeIntegration (cFiles->integration);
+    cFiles->integration = NULL;
+}
+
+static KdeIntegration *
+kdeIntegration (ConfigFiles *cFiles)
+{
+    if (cFiles->integration)
+	return cFiles->integration;
+
+    KdeIntegration *ki = new KdeIntegration ();
+
+    ki->ref = 1;
+
+    for (unsigned int i = 0; i < N_SOPTIONS; i++)
+    {
+	KdeOptionValue &v = ki->options[i];
+	const KdeFile  *kf;
+
+	switch (specialOptions[i].type)
+	{
+	case OptionInt:
+	case OptionBool:
+	    kf = cFiles->kwin;
+	    break;
+	case OptionKey:
+	    kf = cFiles->shortcuts;
+	    break;
+	default:
+	    continue;
+	}
+
+	const QByteArray *entry = kdeEntry (kf, specialOptions[i].groupName,
+					    specialOptions[i].kdeName);
+
+	v.present = entry != NULL;
+
+	if (!v.present)
+	    continue;
+
+	if (specialOptions[i].type == OptionInt)
+	    v.asInt = entryToInt (*entry, 0);
+	else if (specialOptions[i].type == OptionBool)
+	    v.asInt = entryToBool (*entry);
+	else
+	    v.asKey = entryToStringList (*entry);
+    }
+
+    const KdeFile *kwin = cFiles->kwin;
+
+    ki->focusPolicy     = readKdeString (kwin, "Windows", "FocusPolicy");
+    ki->resizeMode      = readKdeString (kwin, "Windows", "ResizeMode");
+    ki->placement       = readKdeString (kwin, "Windows", "Placement");
+    ki->windowSnapZone  = readKdeInt (kwin, "Windows", "WindowSnapZone", 0);
+    ki->borderSnapZone  = readKdeInt (kwin, "Windows", "BorderSnapZone", 0);
+    ki->electricBorders = readKdeInt (kwin, "Windows", "ElectricBorders", 0);
+
+    cFiles->integration = ki;
+
+    return ki;
+}
+
+/* Readers register in the current epoch before loading the snapshot
+   pointer, so a publisher that flipped the epoch only has to wait for
+   the readers of the previous one to take their reference. */
+static ProfileSnapshot *
+acquireSnapshot (ConfigFiles *cFiles)
+{
+    ProfileSnapshot *snapshot;
+    int             epoch;
+
+    for (;;)
+    {
+	epoch = cFiles->epoch;
+	cFiles->readers[epoch].ref ();
+
+	if (epoch == (int) cFiles->epoch)
+	    break;
+
+	cFiles->readers[epoch].deref ();
+    }
+
+    snapshot = cFiles->snapshot;
+
+    if (snapshot)
+	snapshot->ref.ref ();
+
+    cFiles->readers[epoch].deref ();
+
+    return snapshot;
+}
+
+static void
+releaseSnapshot (ProfileSnapshot *snapshot)
+{
+    if (!snapshot || snapshot->ref.deref ())
+	return;
+
+    releaseStore (snapshot->store);
+    releaseKdeIntegration (snapshot->integration);
+    delete snapshot;
+}
+
+/* the snapshot goes with the current store and KDE integration, and a
+   new generation so no reader keeps groups of an older one */
+static void
+publishSnapshot (ConfigFiles     *cFiles,
+		 ProfileSnapshot *snapshot)
+{
+    snapshot->generation  = ++cFiles->generation;
+    snapshot->store       = cFiles->store;
+    snapshot->integration = kdeIntegration (cFiles);
+
+    if (snapshot->store)
+	snapshot->store->ref.ref ();
+
+    snapshot->integration->ref.ref ();
+
+    QMutexLocker    locker (&cFiles->publishLock);
+    ProfileSnapshot *old = cFiles->snapshot.fetchAndStoreOrdered (snapshot);
+    int             epoch = cFiles->epoch;
+
+    cFiles->epoch.fetchAndStoreOrdered (!epoch);
+
+    while (cFiles->readers[epoch] != 0)
+	QThread::yieldCurrentThread ();
+
+    releaseSnapshot (old);
+}
+
+/* for when only the KDE files or the store changed, the entries are
+   shared with the current snapshot */
+static ProfileSnapshot *
+copySnapshot (ConfigFiles *cFiles)
+{
+    ProfileSnapshot *current  = acquireSnapshot (cFiles);
+    ProfileSnapshot *snapshot = new ProfileSnapshot ();
+
+    snapshot->ref = 1;
+
+    if (current)
+	snapshot->entries = current->entries;
+
+    releaseSnapshot (current);
+
+    return snapshot;
+}
+
+/* after a write only the written keys are read back from config, every
+   other group stays shared with the current snapshot */
+static ProfileSnapshot *
+updateSnapshot (ConfigFiles                          *cFiles,
+		KConfig                              *config,
+		const QHash<QString, QSet<QString> > &keys)
+{
+    ProfileSnapshot *snapshot = copySnapshot (cFiles);
+
+    QHash<QString, QSet<QString> >::const_iterator it;
+
+    for (it = keys.constBegin (); it != keys.constEnd (); it++)
+    {
+	KConfigGroup g = config->group (it.key ());
+	GroupEntries &values = snapshot->entries[internString (it.key ())];
+
+	foreach (const QString &key, it.value ())
+	{
+	    if (g.hasKey (key))
+		values.insert (internString (key),
+			       g.readEntry (key, QString ()).toUtf8 ());
+	    else
+		values.remove (key);
+	}
+    }
+
+    return snapshot;
+}
+
+static void
+createFile (QString name)
+{
+    if (!QFile::exists(name))
+    {
+	QFile file (name);
+	file.open (QIODevice::WriteOnly | QIODevice::Append);
+	file.close ();
+    }
+}
+
+
+
+static bool
+isIntegratedOption (CCSSetting *setting)
+{
+    return findSpecialOption (setting) >= 0;
+}
+
+static void
+KdeIntToCCS (const KdeIntegration *ki,
+	     CCSSetting           *setting,
+	     int                  num)
+{
+    const KdeOptionValue &v = ki->options[num];
+
+    ccsSetInt (setting, (v.present) ? v.asInt :
+				      setting->defaultValue.value.asInt);
+}
+
+static void
+KdeBoolToCCS (const KdeIntegration *ki,
+	      CCSSetting           *setting,
+	      int                  num)
+{
+    const KdeOptionValue &v = ki->options[num];
+
+    ccsSetBool (setting, (v.present) ? ((v.asInt) ? TRUE : FALSE) :
+				       setting->defaultValue.value.asBool);
+}
+
+static void
+KdeKeyToCCS (const KdeIntegration *ki,
+	     CCSSetting           *setting,
+	     int                  num)
+{
+    CCSSettingKeyValue keySet;
+    keySet.keysym     = 0;
+    keySet.keyModMask = 0;
+
+    const QStringList &keyData = ki->options[num].asKey;
+
+    if (keyData.size () != 3)
+	return;
+    
+    int key = QKeySequence(keyData[0].split (' ')[0])[0];
+
+    int kdeKeymod = 0;
+
+    if (key & Qt::ShiftModifier)
+	kdeKeymod |= ShiftMask;
+
+    if (key & Qt::ControlModifier)
+	kdeKeymod |= ControlMask;
+
+    if (key & Qt::AltModifier)
+	kdeKeymod |= CompAltMask;
+
+    if (key & Qt::MetaModifier)
+	kdeKeymod |= CompSuperMask;
+
+    keySet.keysym = XStringToKeysym(KShortcut (key & 0x1FFFFFF).toString ()
+				    .toAscii ().constData ());
+    keySet.keyModMask = kdeKeymod;
+    ccsSetKey (setting, keySet);
+}
+
+static void
+readIntegratedOption (const KdeIntegration *ki,
+		      CCSSetting           *setting,
+		      const GroupEntries   &mcg)
+{
+    int option = qMax (0, findSpecialOption (setting));
+
+    switch (specialOptions[option].type)
+    {
+
+    case OptionInt:
+	KdeIntToCCS (ki, setting, option);
+	break;
+
+    case OptionBool:
+	KdeBoolToCCS (ki, setting, option);
+	break;
+
+    case OptionKey:
+	KdeKeyToCCS (ki, setting, option);
+	break;
+
+    case OptionSpecial:
+	if (optionNameIs (option, "command11"))
+	{
+	    ccsSetString (setting, "xkill");
+	}
+	else if (optionNameIs (option, "unmaximize_window_key")
+		 || optionNameIs (option, "maximize_window_key")
+		 || optionNameIs (option, "maximize_window_horizontally_key")
+		 || optionNameIs (option, "maximize_window_vertically_key"))
+	{
+	    CCSSettingKeyValue keyVal;
+
+	    if (!ccsGetKey (setting, &keyVal) )
+		break;
+
+	    keyVal.keysym = 0;
+
+	    keyVal.keyModMask = 0;
+
+	    ccsSetKey (setting, keyVal);
+	}
+	else if (optionNameIs (option, "click_to_focus"))
+	{
+	    Bool val = (ki->focusPolicy == "ClickToFocus") ? TRUE : FALSE;
+	    ccsSetBool (setting, val);
+	}
+	else if (optionNameIs (option, "mode") &&
+		 optionPluginIs (option, "resize"))
+	{
+	    const QString &mode = ki->resizeMode;
+	    int     imode = -1;
+	    int     result = 0;
+
+	    if (mcg.contains (QString (specialOptions[option].settingName) +
+			      " (Integrated)"))
+		imode = mcg.value (QString (specialOptions[option].settingName) +
+				   " (Integrated)").toInt ();
+
+	    if (mode == "Opaque")
+	    {
+		result = 0;
+
+		if (imode == 3)
+		    result = 3;
+	    }
+	    else if (mode == "Transparent")
+	    {
+		result = 1;
+
+		if (imode == 2)
+		    result = 2;
+	    }
+
+	    ccsSetInt (setting, result);
+	}
+	else if (optionNameIs (option, "snap_type"))
+	{
+	    static int intList[2] = {0, 1};
+	    CCSSettingValueList list = ccsGetValueListFromIntArray (intList, 2,
+								    setting);
+	    ccsSetList (setting, list);
+	    ccsSettingValueListFree (list, TRUE);
+	}
+	else if (optionNameIs (option, "resistance_distance") ||
+		 optionNameIs (option, "attraction_distance"))
+	{
+	    int val1 = ki->windowSnapZone;
+	    int val2 = ki->borderSnapZone;
+	    int result = qMax (val1, val2);
+
+	    if (result == 0)
+		result = mcg.value ("snap_distance (Integrated)").toInt ();
+
+	    if (result > 0)
+	    	ccsSetInt (setting, result);
+	}
+	else if (optionNameIs (option, "edges_categories"))
+	{
+	    int val1 = ki->windowSnapZone;
+	    int val2 = ki->borderSnapZone;
+	    int intList[2] = {0, 0};
+	    int num = 0;
+
+	    if (val2 > 0)
+		num++;
+	    if (val1 > 0)
+	    {
+		intList[num] = 1;
+		num++;
+	    }
+
+	    CCSSettingValueList list = ccsGetValueListFromIntArray (intList,
+								    num,
+								    setting);
+	    ccsSetList (setting, list);
+	    ccsSettingValueListFree (list, TRUE);
+	}
+	else if (optionNameIs (option, "edge_flip_window") ||
+		 optionNameIs (option, "edgeflip_move"))
+	{
+	    if (ki->electricBorders > 0)
+		ccsSetBool (setting, TRUE);
+	    else
+		ccsSetBool (setting, FALSE);
+	}
+	else if (optionNameIs (option, "edge_flip_pointer") ||
+		 optionNameIs (option, "edgeflip_pointer"))
+	{
+	    if (ki->electricBorders > 1)
+		ccsSetBool (setting, TRUE);
+	    else
+		ccsSetBool (setting, FALSE);
+	}
+	else if (optionNameIs (option, "mode") &&
+		 optionPluginIs (option, "place"))
+	{
+	    const QString &mode = ki->placement;
+	    int     result = 0;
+
+	    if (mode == "Smart")
+		result = 2;
+	    else if (mode == "Maximizing")
+		result = 3;
+	    else if (mode == "Cascade")
+		result = 0;
+	    else if (mode == "Random")
+		result = 4;
+	    else if (mode == "Centered")
+		result = 1;
+
+	    ccsSetInt (setting, result);
+	}
+	break;
+
+    default:
+	break;
+    }
+}
+
+static Bool
+getSettingIsIntegrated (CCSSetting *setting)
+{
+    return ccsGetIntegrationEnabled (setting->parent->context)
+	   && isIntegratedOption (setting);
+}
+
+
+static Bool
+getSettingIsReadOnly (CCSSetting *setting)
+{
+    if (!ccsGetIntegrationEnabled (setting->parent->context)
+	|| !isIntegratedOption (setting) )
+	return FALSE;
+
+    int option = qMax (0, findSpecialOption (setting));
+
+    switch (specialOptions[option].type)
+    {
+    case OptionSpecial:
+	if (optionNameIs (option, "command11"))
+	{
+	    return TRUE;
+	}
+	else if (optionNameIs (option, "map_on_shutdown"))
+	{
+	    return TRUE;
+	}
+	else if (optionNameIs (option, "unmaximize_window_key")
+		 || optionNameIs (option, "maximize_window_key")
+		 || optionNameIs (option, "maximize_window_horizontally_key")
+		 || optionNameIs (option, "maximize_window_vertically_key"))
+	{
+	    return TRUE;
+	}
+	else if (optionNameIs (option, "snap_type") ||
+		 optionNameIs (option, "attraction_distance"))
+	{
+	    return TRUE;
+	}
+	break;
+
+    default:
+	break;
+    }
+
+    return FALSE;
+}
+
+static CCSStringList
+getExistingProfiles (CCSContext *)
+{
+    initComponentData ();
+
+    QMutexLocker locker (&kdeDirsLock ());
+    QDir         dir (KGlobal::dirs()->saveLocation ("config", QString::null, false),
+	      				     "compizrc.*");
+
+    QStringList files = dir.entryList();
+    CCSStringList ret = NULL;
+    QSet<QString> profiles;
+
+    QStringList::iterator it;
+
+    for (it = files.begin(); it != files.end(); it++)
+    {
+	QString str = (*it);
+
+	if (str.endsWith (".ccs-commit") || str.endsWith (JOURNAL_SUFFIX) ||
+	    str.endsWith (COMPACTION_SUFFIX) ||
+	    str.endsWith (STORE_SUFFIX "-journal"))
+	    continue;
+
+	if (str.endsWith (STORE_SUFFIX))
+	    str.chop (strlen (STORE_SUFFIX));
+
+	if (str.length() > 9)
+	{
+	    QString profile = str.right (str.length() - 9);
+
+	    if (!profile.isEmpty() && !profiles.contains (profile))
+	    {
+		profiles.insert (profile);
+		ret = ccsStringListAppend (ret, 
+		    strdup (profile.toAscii().constData()));
+	    }
+	}
+    }
+
+    /* layered profiles exist as soon as they name a parent */
+    KConfig options ("ccs-backend-kconfig4rc", KConfig::SimpleConfig);
+
+    foreach (const QString &group, options.groupList ())
+    {
+	if (!group.startsWith ("Profile "))
+	    continue;
+
+	QString profile = group.mid (8);
+
+	if (profile == "Default" || profiles.contains (profile) ||
+	    !profileHasParent (options, profile))
+	    continue;
+
+	profiles.insert (profile);
+	ret = ccsStringListAppend (ret, strdup (profile.toAscii ().constData ()));
+    }
+
+    return ret;
+}
+
+/* copies the keys of layer that child does not override into child */
+static void
+flattenLayer (const QString &layer,
+	      const QString &child)
+{
+    QMutexLocker locker (&kdeDirsLock ());
+
+    KConfig from (layer, KConfig::SimpleConfig);
+    KConfig to (child, KConfig::SimpleConfig);
+
+    foreach (const QString &group, from.groupList ())
+    {
+	QMap<QString, QString>                 entries =
+	    from.group (group).entryMap ();
+	QMap<QString, QString>::const_iterator it;
+	KConfigGroup                           dst = to.group (group);
+
+	for (it = entries.constBegin (); it != entries.constEnd (); it++)
+	{
+	    if (!dst.hasKey (it.key ()))
+		dst.writeEntry (it.key (), it.value ());
+	}
+    }
+
+    to.sync ();
+}
+
+/* children of a deleted profile take over its keys and its parent */
+static void
+unlinkLayer (const QString &configDir,
+	     const QString &profile)
+{
+    QMutexLocker locker (&kdeDirsLock ());
+
+    KConfig options ("ccs-backend-kconfig4rc", KConfig::SimpleConfig);
+    QString layer = configDir + profileConfigName (profile);
+
+    foreach (const QString &group, options.groupList ())
+    {
+	if (!group.startsWith ("Profile "))
+	    continue;
+
+	QString child = group.mid (8);
+
+	if (child == "Default")
+	    child = QString ();
+
+	if (child == profile || !profileHasParent (options, child) ||
+	    profileParent (options, child) != profile)
+	    continue;
+
+	if (!profileUsesStore (child))
+	    flattenLayer (layer, configDir + profileConfigName (child));
+
+	KConfigGroup cg = options.group (group);
+
+	if (profileHasParent (options, profile))
+	    cg.writeEntry ("Parent", options.group (
+			   profileOptionsGroup (profile)).
+			   readEntry ("Parent", QString ()));
+	else
+	    cg.deleteEntry ("Parent");
+    }
+
+    options.deleteGroup (profileOptionsGroup (profile));
+    options.sync ();
+}
+
+/* entries are formatted on the stack, only what KConfig keeps of them
+   ends up on the heap */
+typedef QVarLengthArray<char, 256> FormatBuffer;
+
+static inline void
+appendBytes (FormatBuffer &out,
+	     const char   *data,
+	     int          len)
+{
+    out.append (data, len);
+}
+
+static inline void
+appendBytes (FormatBuffer &out,
+	     const char   *str)
+{
+    out.append (str, strlen (str));
+}
+
+static inline void
+appendBytes (FormatBuffer     &out,
+	     const QByteArray &data)
+{
+    out.append (data.constData (), data.size ());
+}
+
+static void
+appendInt (FormatBuffer &out,
+	   int          value)
+{
+    char         buf[12];
+    char         *p = buf + sizeof (buf);
+    unsigned int u = (value < 0) ? -(unsigned int) value : value;
+
+    do
+    {
+	*--p = '0' + u % 10;
+	u /= 10;
+    }
+    while (u);
+
+    if (value < 0)
+	*--p = '-';
+
+    appendBytes (out, p, buf + sizeof (buf) - p);
+}
+
+/* same output as QByteArray::number (value, 'g', precision), always
+   with a '.' whatever the numeric locale says */
+static void
+appendDouble (FormatBuffer &out,
+	      double       value,
+	      int          precision)
+{
+    char       buf[40];
+    int        len = snprintf (buf, sizeof (buf), "%.*g", precision, value);
+    const char *point = localeconv ()->decimal_point;
+
+    if (len < 0 || len >= (int) sizeof (buf))
+    {
+	appendBytes (out, QByteArray::number (value, 'g', precision));
+	return;
+    }
+
+    if (point && strcmp (point, "."))
+    {
+	char *found = strstr (buf, point);
+	int  pointLen = strlen (point);
+
+	if (found)
+	{
+	    *found = '.';
+	    memmove (found + 1, found + pointLen,
+		     buf + len + 1 - (found + pointLen));
+	    len -= pointLen - 1;
+	}
+    }
+
+    appendBytes (out, buf, len);
+}
+
+static void
+appendListElement (FormatBuffer       &entry,
+		   const FormatBuffer &element,
+		   bool               first)
+{
+    if (!first)
+	entry.append (',');
+
+    for (int i = 0; i < element.size (); i++)
+    {
+	if (element[i] == '\\' || element[i] == ',')
+	    entry.append ('\\');
+
+	entry.append (element[i]);
+    }
+}
+
+/* One codec per value type, parsing and formatting single values straight
+   from and to the stored bytes. List elements use the scalar functions
+   unless the codec overrides them, and own () makes a decoded element
+   independent of the entry it was parsed from. */
+template <typename C>
+struct CodecDefaults
+{
+    static inline bool
+    decodeElement (const QByteArray &entry,
+		   CCSSettingValue  *value)
+    {
+	return C::decode (entry, value);
+    }
+
+    static inline void
+    encodeElement (const CCSSettingValue *value,
+		   FormatBuffer          &entry)
+    {
+	C::encode (value, entry);
+    }
+
+    static inline void
+    own (CCSSettingValue *)
+    {
+    }
+};
+
+template <CCSSettingType T>
+struct Codec;
+
+template <>
+struct Codec<TypeBool> : CodecDefaults<Codec<TypeBool> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	value->value.asBool = (entryToBool (entry)) ? TRUE : FALSE;
+	return true;
+    }
+
+    static inline bool
+    decodeElement (const QByteArray &entry,
+		   CCSSettingValue  *value)
+    {
+	value->value.asBool = (listEntryToBool (entry)) ? TRUE : FALSE;
+	return true;
+    }
+
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	appendBytes (entry, (value->value.asBool) ? "true" : "false");
+    }
+
+    static inline void
+    encodeElement (const CCSSettingValue *value,
+		   FormatBuffer          &entry)
+    {
+	entry.append ((value->value.asBool) ? '1' : '0');
+    }
+};
+
+template <>
+struct Codec<TypeBell> : CodecDefaults<Codec<TypeBell> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	value->value.asBell = (entryToBool (entry)) ? TRUE : FALSE;
+	return true;
+    }
+
+    static inline bool
+    decodeElement (const QByteArray &entry,
+		   CCSSettingValue  *value)
+    {
+	value->value.asBell = (listEntryToBool (entry)) ? TRUE : FALSE;
+	return true;
+    }
+
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	appendBytes (entry, (value->value.asBell) ? "true" : "false");
+    }
+
+    static inline void
+    encodeElement (const CCSSettingValue *value,
+		   FormatBuffer          &entry)
+    {
+	entry.append ((value->value.asBell) ? '1' : '0');
+    }
+};
+
+template <>
+struct Codec<TypeInt> : CodecDefaults<Codec<TypeInt> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	value->value.asInt = entry.toInt ();
+	return true;
+    }
+
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	appendInt (entry, value->value.asInt);
+    }
+};
+
+template <>
+struct Codec<TypeFloat> : CodecDefaults<Codec<TypeFloat> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	value->value.asFloat = entry.toDouble ();
+	return true;
+    }
+
+    static inline bool
+    decodeElement (const QByteArray &entry,
+		   CCSSettingValue  *value)
+    {
+	value->value.asFloat = entry.toFloat ();
+	return true;
+    }
+
+    /* same precision KConfig uses for a double */
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	appendDouble (entry, value->value.asFloat, 15);
+    }
+
+    static inline void
+    encodeElement (const CCSSettingValue *value,
+		   FormatBuffer          &entry)
+    {
+	appendDouble (entry, value->value.asFloat, 6);
+    }
+};
+
+template <>
+struct Codec<TypeString> : CodecDefaults<Codec<TypeString> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	value->value.asString = (char *) entry.constData ();
+	return true;
+    }
+
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	if (value->value.asString)
+	    appendBytes (entry, value->value.asString);
+    }
+
+    static inline void
+    own (CCSSettingValue *value)
+    {
+	value->value.asString = strdup (value->value.asString);
+    }
+};
+
+template <>
+struct Codec<TypeMatch> : CodecDefaults<Codec<TypeMatch> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	value->value.asMatch = (char *) entry.constData ();
+	return true;
+    }
+
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	if (value->value.asMatch)
+	    appendBytes (entry, value->value.asMatch);
+    }
+
+    static inline void
+    own (CCSSettingValue *value)
+    {
+	value->value.asMatch = strdup (value->value.asMatch);
+    }
+};
+
+template <>
+struct Codec<TypeColor> : CodecDefaults<Codec<TypeColor> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	return stringToColor (entry, &value->value.asColor);
+    }
+
+    /* a broken list element becomes opaque black instead of vanishing */
+    static inline bool
+    decodeElement (const QByteArray &entry,
+		   CCSSettingValue  *value)
+    {
+	if (!stringToColor (entry, &value->value.asColor))
+	{
+	    memset (&value->value.asColor, 0, sizeof (CCSSettingColorValue));
+	    value->value.asColor.color.alpha = 0xffff;
+	}
+
+	return true;
+    }
+
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	char hex[9];
+
+	hex[0] = '#';
+	colorToHex (&value->value.asColor, hex + 1);
+	appendBytes (entry, hex, sizeof (hex));
+    }
+};
+
+template <>
+struct Codec<TypeKey> : CodecDefaults<Codec<TypeKey> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	return cachedStringToKeyBinding (entry, &value->value.asKey);
+    }
+
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	appendBytes (entry, cachedKeyBindingToString (
+		     (CCSSettingKeyValue *) &value->value.asKey));
+    }
+};
+
+template <>
+struct Codec<TypeButton> : CodecDefaults<Codec<TypeButton> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	return cachedStringToButtonBinding (entry, &value->value.asButton);
+    }
+
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	appendBytes (entry, cachedButtonBindingToString (
+		     (CCSSettingButtonValue *) &value->value.asButton));
+    }
+};
+
+template <>
+struct Codec<TypeEdge> : CodecDefaults<Codec<TypeEdge> >
+{
+    static inline bool
+    decode (const QByteArray &entry,
+	    CCSSettingValue  *value)
+    {
+	value->value.asEdge = cachedStringToEdges (entry);
+	return true;
+    }
+
+    static inline void
+    encode (const CCSSettingValue *value,
+	    FormatBuffer          &entry)
+    {
+	appendBytes (entry, cachedEdgesToString (value->value.asEdge));
+    }
+};
+
+template <CCSSettingType T>
+static void
+readValue (CCSSetting       *setting,
+	   const QByteArray &entry)
+{
+    CCSSettingValue value;
+
+    memset (&value, 0, sizeof (CCSSettingValue));
+    value.parent = setting;
+
+    if (Codec<T>::decode (entry, &value))
+	ccsSetValue (setting, &value);
+}
+
+template <CCSSettingType T>
+static void
+readList (CCSSetting       *setting,
+	  const QByteArray &entry)
+{
+    CCSSettingValueList l = NULL;
+    QByteArray          element;
+    int                 pos = 0;
+
+    while (nextListElement (entry, pos, element))
+    {
+	CCSSettingValue *value =
+	    (CCSSettingValue *) calloc (1, sizeof (CCSSettingValue));
+
+	if (!value)
+	    break;
+
+	value->parent      = setting;
+	value->isListChild = TRUE;
+
+	if (!Codec<T>::decodeElement (element, value))
+	{
+	    free (value);
+	    continue;
+	}
+
+	Codec<T>::own (value);
+	l = ccsSettingValueListAppend (l, value);
+    }
+
+    ccsSetList (setting, l);
+    ccsSettingValueListFree (l, TRUE);
+}
+
+template <CCSSettingType T>
+static void
+writeValue (CCSSetting   *setting,
+	    FormatBuffer &entry)
+{
+    Codec<T>::encode (setting->value, entry);
+}
+
+template <CCSSettingType T>
+static void
+writeList (CCSSetting   *setting,
+	   FormatBuffer &entry)
+{
+    FormatBuffer element;
+    bool         first = true;
+
+    for (CCSSettingValueList l = setting->value->value.asList; l; l = l->next)
+    {
+	element.clear ();
+	Codec<T>::encodeElement (l->data, element);
+	appendListElement (entry, element, first);
+	first = false;
+    }
+
+    /* tells a list of one empty element from an empty list */
+    if (!first && entry.isEmpty ())
+	appendBytes (entry, "\\0");
+}
+
+/* readList<TypeColor> with the hex digits of all elements decoded in
+   one hexToColors () call */
+static void
+readColorList (CCSSetting       *setting,
+	       const QByteArray &entry)
+{
+    QList<QByteArray> elements;
+    QByteArray        element;
+    int               pos = 0;
+
+    while (nextListElement (entry, pos, element))
+	elements.append (element);
+
+    int                                      n = elements.size ();
+    QVarLengthArray<const char *, 64>        hex (n);
+    QVarLengthArray<CCSSettingColorValue, 64> colors (n);
+    QVarLengthArray<bool, 64>                valid (n);
+
+    for (int i = 0; i < n; i++)
+	hex[i] = (elements[i].length () == 9 && elements[i][0] == '#') ?
+		 elements[i].constData () + 1 : NULL;
+
+    hexToColors (hex.constData (), colors.data (), valid.data (), n);
+
+    CCSSettingValueList l = NULL;
+
+    for (int i = 0; i < n; i++)
+    {
+	CCSSettingValue *value =
+	    (CCSSettingValue *) calloc (1, sizeof (CCSSettingValue));
+
+	if (!value)
+	    break;
+
+	value->parent      = setting;
+	value->isListChild = TRUE;
+
+	if (valid[i])
+	    value->value.asColor = colors[i];
+	else
+	    Codec<TypeColor>::decodeElement (elements[i], value);
+
+	l = ccsSettingValueListAppend (l, value);
+    }
+
+    ccsSetList (setting, l);
+    ccsSettingValueListFree (l, TRUE);
+}
+
+/* writeList<TypeColor> with all elements encoded in one colorsToHex ()
+   call; colors never need escaping */
+static void
+writeColorList (CCSSetting   *setting,
+		FormatBuffer &entry)
+{
+    QVarLengthArray<CCSSettingColorValue, 64> colors;
+
+    for (CCSSettingValueList l = setting->value->value.asList; l; l = l->next)
+	colors.append (l->data->value.asColor);
+
+    QVarLengthArray<char, 512> hex (colors.size () * 8);
+
+    colorsToHex (colors.constData (), hex.data (), colors.size ());
+
+    for (int i = 0; i < colors.size (); i++)
+    {
+	if (i)
+	    entry.append (',');
+
+	entry.append ('#');
+	appendBytes (entry, hex.constData () + i * 8, 8);
+    }
+}
+
+static void
+decodeSetting (CCSSetting       *setting,
+	       const QByteArray &entry)
+{
+    switch (setting->type)
+    {
+    case TypeBool:
+	readValue<TypeBool> (setting, entry);
+	break;
+    case TypeInt:
+	readValue<TypeInt> (setting, entry);
+	break;
+    case TypeFloat:
+	readValue<TypeFloat> (setting, entry);
+	break;
+    case TypeString:
+	readValue<TypeString> (setting, entry);
+	break;
+    case TypeMatch:
+	readValue<TypeMatch> (setting, entry);
+	break;
+    case TypeColor:
+	readValue<TypeColor> (setting, entry);
+	break;
+    case TypeKey:
+	readValue<TypeKey> (setting, entry);
+	break;
+    case TypeButton:
+	readValue<TypeButton> (setting, entry);
+	break;
+    case TypeEdge:
+	readValue<TypeEdge> (setting, entry);
+	break;
+    case TypeBell:
+	readValue<TypeBell> (setting, entry);
+	break;
+    case TypeList:
+	switch (setting->info.forList.listType)
+	{
+	case TypeBool:
+	    readList<TypeBool> (setting, entry);
+	    break;
+	case TypeInt:
+	    readList<TypeInt> (setting, entry);
+	    break;
+	case TypeFloat:
+	    readList<TypeFloat> (setting, entry);
+	    break;
+	case TypeString:
+	    readList<TypeString> (setting, entry);
+	    break;
+	case TypeMatch:
+	    readList<TypeMatch> (setting, entry);
+	    break;
+	case TypeColor:
+	    readColorList (setting, entry);
+	    break;
+	case TypeKey:
+	    readList<TypeKey> (setting, entry);
+	    break;
+	case TypeButton:
+	    readList<TypeButton> (setting, entry);
+	    break;
+	case TypeEdge:
+	    readList<TypeEdge> (setting, entry);
+	    break;
+	case TypeBell:
+	    readList<TypeBell> (setting, entry);
+	    break;
+	default:
+	    break;
+	}
+	break;
+    default:
+	kDebug () << "Not supported setting type : " << setting->type << endl;
+	break;
+    }
+}
+
+static bool
+encodeSetting (CCSSetting   *setting,
+	       FormatBuffer &entry)
+{
+    switch (setting->type)
+    {
+    case TypeBool:
+	writeValue<TypeBool> (setting, entry);
+	break;
+    case TypeInt:
+	writeValue<TypeInt> (setting, entry);
+	break;
+    case TypeFloat:
+	writeValue<TypeFloat> (setting, entry);
+	break;
+    case TypeString:
+	writeValue<TypeString> (setting, entry);
+	break;
+    case TypeMatch:
+	writeValue<TypeMatch> (setting, entry);
+	break;
+    case TypeColor:
+	writeValue<TypeColor> (setting, entry);
+	break;
+    case TypeKey:
+	writeValue<TypeKey> (setting, entry);
+	break;
+    case TypeButton:
+	writeValue<TypeButton> (setting, entry);
+	break;
+    case TypeEdge:
+	writeValue<TypeEdge> (setting, entry);
+	break;
+    case TypeBell:
+	writeValue<TypeBell> (setting, entry);
+	break;
+    case TypeList:
+	switch (setting->info.forList.listType)
+	{
+	case TypeBool:
+	    writeList<TypeBool> (setting, entry);
+	    break;
+	case TypeInt:
+	    writeList<TypeInt> (setting, entry);
+	    break;
+	case TypeFloat:
+	    writeList<TypeFloat> (setting, entry);
+	    break;
+	case TypeString:
+	    writeList<TypeString> (setting, entry);
+	    break;
+	case TypeMatch:
+	    writeList<TypeMatch> (setting, entry);
+	    break;
+	case TypeColor:
+	    writeColorList (setting, entry);
+	    break;
+	case TypeKey:
+	    writeList<TypeKey> (setting, entry);
+	    break;
+	case TypeButton:
+	    writeList<TypeButton> (setting, entry);
+	    break;
+	case TypeEdge:
+	    writeList<TypeEdge> (setting, entry);
+	    break;
+	case TypeBell:
+	    writeList<TypeBell> (setting, entry);
+	    break;
+	default:
+	    return false;
+	}
+	break;
+    default:
+	kDebug () << "Not supported setting type : " << setting->type << endl;
+	return false;
+    }
+
+    return true;
+}
+
+static void
+readSettingEntries (CCSContext            *c,
+		    const ProfileSnapshot *snapshot,
+		    CCSSetting            *setting,
+		    const GroupEntries    &cfg)
+{
+    QString key = internName (setting->name);
+
+    if (ccsGetIntegrationEnabled (c) && isIntegratedOption (setting) )
+    {
+	readIntegratedOption (snapshot->integration, setting, cfg);
+	return;
+    }
+
+    if (!cfg.contains (key) )
+    {
+	ccsResetToDefault (setting);
+	return;
+    }
+
+    decodeSetting (setting, cfg.value (key));
+}
+
+static void
+readSetting (CCSContext *c,
+	     CCSSetting *setting)
+{
+    ConfigFiles     *cFiles = filesForContext (c);
+    ProfileSnapshot *snapshot = acquireSnapshot (cFiles);
+
+    if (!snapshot)
+	return;
+
+    QString group = settingGroup (setting);
+
+    /* never blocks behind a reload or write, we keep whatever snapshot
+       was current until we are done with this setting */
+    if (snapshot->store)
+	readSettingEntries (c, snapshot, setting,
+			    storeGroup (snapshot, group));
+    else
+	readSettingEntries (c, snapshot, setting,
+			    snapshot->entries.value (group));
+
+    releaseSnapshot (snapshot);
+}
+
+/* a plain INI profile is read by parseProfileFile (), KConfig only
+   parses it once it gets written to or has a journal to apply */
+static KConfig *
+mainConfig (ConfigFiles *cFiles)
+{
+    if (!cFiles->main)
+    {
+	QMutexLocker locker (&kdeDirsLock ());
+
+	cFiles->main = new KConfig (cFiles->mainName);
+    }
+
+    return cFiles->main;
+}
+
+static KdeFile *
+kdeFile (ConfigFiles  *cFiles,
+	 ConfigFileId file)
+{
+    return (file == FileKwin) ? cFiles->kwin : cFiles->shortcuts;
+}
+
+static QString
+filePath (ConfigFiles  *cFiles,
+	  ConfigFileId file)
+{
+    if (file == FileMain && cFiles->store)
+	return cFiles->store->path;
+
+    /* without opening a profile that is only read so far */
+    if (file == FileMain && !cFiles->main)
+	return cFiles->configDir + cFiles->mainName;
+
+    if (file == FileMain)
+	return cFiles->configDir + cFiles->main->name ();
+
+    /* we only ever write the user's own copy */
+    return cFiles->configDir + kdeFile (cFiles, file)->name;
+}
+
+static void
+markDirty (ConfigFiles   *cFiles,
+	   ConfigFileId  file,
+	   const QString &group,
+	   const QString &key)
+{
+    cFiles->dirty[file][group].insert (key);
+}
+
+/* the bytes KConfigGroup::writeEntry () stores for a value */
+static QByteArray
+kdeEntryValue (int value)
+{
+    return QByteArray::number (value);
+}
+
+static QByteArray
+kdeEntryValue (bool value)
+{
+    return (value) ? "true" : "false";
+}
+
+static QByteArray
+kdeEntryValue (const QString &value)
+{
+    return value.toUtf8 ();
+}
+
+static QByteArray
+kdeEntryValue (const QStringList &value)
+{
+    QByteArray entry;
+
+    /* tells a list of one empty element from an empty list */
+    if (value.size () == 1 && value[0].isEmpty ())
+	return "\\0";
+
+    for (int i = 0; i < value.size (); i++)
+    {
+	QByteArray element = value[i].toUtf8 ();
+
+	if (i)
+	    entry += ',';
+
+	for (int j = 0; j < element.size (); j++)
+	{
+	    if (element[j] == '\\' || element[j] == ',')
+		entry += '\\';
+
+	    entry += element[j];
+	}
+    }
+
+    return entry;
+}
+
+template <typename T>
+static void
+writeKdeEntry (ConfigFiles   *cFiles,
+	       ConfigFileId  file,
+	       const QString &group,
+	       const QString &key,
+	       const T       &value)
+{
+    if (file == FileMain)
+    {
+	KConfigGroup g = mainConfig (cFiles)->group (group);
+
+	if (g.hasKey (key) && g.readEntry (key, value) == value)
+	    return;
+
+	g.writeEntry (key, value);
+    }
+    else
+    {
+	KdeFile          *kf = kdeFile (cFiles, file);
+	QByteArray       entry = kdeEntryValue (value);
+	const QByteArray *old = kdeEntry (kf, group, key);
+
+	if (old && *old == entry)
+	    return;
+
+	kf->entries[group].insert (key, entry);
+    }
+
+    markDirty (cFiles, file, group, key);
+}
+
+static void
+CCSIntToKde (ConfigFiles *cFiles,
+	     CCSSetting  *setting,
+	     int         num)
+{
+    int val;
+
+    if (!ccsGetInt (setting, &val) )
+	return;
+
+    writeKdeEntry (cFiles, FileKwin, specialOptions[num].groupName,
+		   specialOptions[num].kdeName, val);
+}
+
+static void
+CCSBoolToKde (ConfigFiles *cFiles,
+	      CCSSetting  *setting,
+	      int         num)
+{
+    Bool val;
+
+    if (!ccsGetBool (setting, &val) )
+	return;
+
+    writeKdeEntry (cFiles, FileKwin, specialOptions[num].groupName,
+		   specialOptions[num].kdeName, bool (val));
+}
+
+static void
+CCSKeyToKde (ConfigFiles *cFiles,
+	     CCSSetting  *setting,
+	     int         num)
+{
+
+    CCSSettingKeyValue keyVal;
+
+    if (!ccsGetKey (setting, &keyVal) )
+        return;
+
+    int key = QKeySequence (XKeysymToString (keyVal.keysym));
+
+    if (keyVal.keyModMask & ShiftMask)
+	key |= Qt::ShiftModifier;
+
+    if (keyVal.keyModMask & ControlMask)
+	key |= Qt::ControlModifier;
+
+    if (keyVal.keyModMask & CompAltMask)
+	key |= Qt::AltModifier;
+
+    if (keyVal.keyModMask & CompSuperMask)
+	key |= Qt::MetaModifier;
+
+
+    QStringList keyData = readKdeList (cFiles->shortcuts,
+				       specialOptions[num].groupName,
+				       specialOptions[num].kdeName);
+
+    if (keyData.size () != 3)
+	return;
+
+    QStringList kl = keyData[0].split (' ');
+
+    kl[0] = (key)? QKeySequence(key).toString () : "none";
+
+    keyData[0] = kl.join (" ");
+
+    writeKdeEntry (cFiles, FileShortcuts, specialOptions[num].groupName,
+		   specialOptions[num].kdeName, keyData);
+}
+
+
+static CCSSetting *
+findSibling (CCSSetting *setting,
+	     const char *name)
+{
+    return ccsFindSetting (setting->parent, name,
+			   setting->isScreen, setting->screenNum);
+}
+
+/* every screen of the snap plugin takes part, the zones are the largest
+   distance of those snapping to edges or windows respectively */
+static void
+writeSnapZones (ConfigFiles *cFiles)
+{
+    CCSPlugin *plugin = ccsFindPlugin (cFiles->context, "snap");
+    int       borderZone = 0, windowZone = 0;
+    bool      found = false;
+
+    for (CCSSettingList l = (plugin) ? plugin->settings : NULL; l; l = l->next)
+    {
+	CCSSetting          *dist = l->data;
+	CCSSetting          *edges;
+	CCSSettingValueList sList;
+	int                 *values, numValues;
+	int                 iVal = 0;
+	bool                edge = false, window = false;
+
+	if (strcmp (dist->name, "resistance_distance"))
+	    continue;
+
+	edges = findSibling (dist, "edges_categories");
+
+	if (!edges || !ccsGetList (edges, &sList) || !ccsGetInt (dist, &iVal))
+	    continue;
+
+	values = ccsGetIntArrayFromValueList (sList, &numValues);
+
+	for (int i = 0; i < numValues; i++)
+	{
+	    if (values[i] == 0)
+		edge = true;
+	    if (values[i] == 1)
+		window = true;
+	}
+
+	if (values)
+	    free (values);
+
+	found = true;
+
+	if (edge)
+	    borderZone = qMax (borderZone, iVal);
+	if (window)
+	    windowZone = qMax (windowZone, iVal);
+
+	writeKdeEntry (cFiles, FileMain, settingGroup (dist),
+		       "snap_distance (Integrated)", iVal);
+    }
+
+    if (!found)
+	return;
+
+    writeKdeEntry (cFiles, FileKwin, "Windows", "BorderSnapZone", borderZone);
+    writeKdeEntry (cFiles, FileKwin, "Windows", "WindowSnapZone", windowZone);
+}
+
+/* 0 = off, 1 = only while moving windows, 2 = always; rotate and wall
+   on any screen take part, flipping with the pointer wins */
+static void
+writeElectricBorders (ConfigFiles *cFiles)
+{
+    static const char *sources[][3] =
+    {
+	/* plugin, window, pointer */
+	{"rotate", "edge_flip_window", "edge_flip_pointer"},
+	{"wall", "edgeflip_move", "edgeflip_pointer"}
+    };
+
+    bool hasWindow = false, hasPointer = false;
+    bool window = false, pointer = false;
+    int  val;
+
+    for (unsigned int i = 0; i < sizeof (sources) / sizeof (sources[0]); i++)
+    {
+	CCSPlugin *plugin = ccsFindPlugin (cFiles->context, sources[i][0]);
+
+	for (CCSSettingList l = (plugin) ? plugin->settings : NULL; l;
+	     l = l->next)
+	{
+	    Bool bVal;
+
+	    if (!strcmp (l->data->name, sources[i][1]) &&
+		ccsGetBool (l->data, &bVal))
+	    {
+		hasWindow = true;
+		window   |= bVal != FALSE;
+	    }
+	    else if (!strcmp (l->data->name, sources[i][2]) &&
+		     ccsGetBool (l->data, &bVal))
+	    {
+		hasPointer = true;
+		pointer   |= bVal != FALSE;
+	    }
+	}
+    }
+
+    if (!hasWindow && !hasPointer)
+	return;
+
+    if (pointer)
+	val = 2;
+    else if (window)
+	val = (hasPointer) ? 1 : qMax (1, readKdeInt (cFiles->kwin, "Windows",
+						      "ElectricBorders", 0));
+    else
+	val = 0;
+
+    writeKdeEntry (cFiles, FileKwin, "Windows", "ElectricBorders", val);
+}
+
+/* from the values the settings have at the end of the pass, whichever
+   of them were written and in whatever order */
+static void
+writeDerivedKeys (ConfigFiles *cFiles)
+{
+    if (cFiles->derived & DeriveSnapZones)
+	writeSnapZones (cFiles);
+    if (cFiles->derived & DeriveElectricBorders)
+	writeElectricBorders (cFiles);
+
+    cFiles->derived = 0;
+}
+
+static void
+writeIntegratedOption (ConfigFiles *cFiles,
+		       CCSSetting  *setting)
+{
+    int option = qMax (0, findSpecialOption (setting));
+
+    QString group = settingGroup (setting);
+
+    switch (specialOptions[option].type)
+    {
+
+    case OptionInt:
+	CCSIntToKde (cFiles, setting, option);
+	break;
+
+    case OptionBool:
+	CCSBoolToKde (cFiles, setting, option);
+	break;
+    case OptionKey:
+	CCSKeyToKde (cFiles, setting, option);
+	break;
+
+    case OptionSpecial:
+	if (optionNameIs (option, "command11")
+	    || optionNameIs (option, "unmaximize_window_key")
+	    || optionNameIs (option, "maximize_window_key")
+	    || optionNameIs (option, "maximize_window_horizontally_key")
+	    || optionNameIs (option, "maximize_window_vertically_key"))
+	    break;
+
+	if (optionNameIs (option, "click_to_focus"))
+	{
+	    QString mode = readKdeString (cFiles->kwin, "Windows",
+					  "FocusPolicy");
+	    QString val = "ClickToFocus";
+	    Bool bVal;
+
+	    if (!ccsGetBool (setting, &bVal) )
+		break;
+
+	    if (!bVal)
+	    {
+		val = "FocusFollowsMouse";
+	    }
+
+	    if (mode != val)
+		writeKdeEntry (cFiles, FileKwin, "Windows", "FocusPolicy", val);
+	}
+	if (optionNameIs (option, "mode") &&
+	    optionPluginIs (option, "resize"))
+	{
+	    QString mode = readKdeString (cFiles->kwin, "Windows",
+					  "ResizeMode");
+	    QString val = "Opaque";
+	    int     iVal;
+	    if (ccsGetInt(setting, &iVal) && (iVal == 1 || iVal == 2))
+	    {
+		val = "Transparent";
+	    }
+	    if (mode != val)
+		writeKdeEntry (cFiles, FileKwin, "Windows", "ResizeMode", val);
+	    writeKdeEntry (cFiles, FileMain, group,
+			   QString (specialOptions[option].settingName) + " (Integrated)",
+			   iVal);
+	}
+
+	if (optionNameIs (option, "resistance_distance") ||
+	    optionNameIs (option, "edges_categories"))
+	    cFiles->derived |= DeriveSnapZones;
+	else if (optionNameIs (option, "next_key") ||
+		 optionNameIs (option, "prev_key"))
+	{
+	    CCSSettingKeyValue keyVal;
+
+	    if (!ccsGetKey (setting, &keyVal))
+		break;
+
+	    if (keyVal.keysym == 0 && keyVal.keyModMask == 0)
+		break;
+
+	    CCSKeyToKde (cFiles, setting, option);
+
+	    writeKdeEntry (cFiles, FileKwin, "TabBox", "TraverseAll", false);
+	    writeKdeEntry (cFiles, FileKwin, "Windows", "AltTabStyle",
+			   QString ("KDE"));
+	}
+	else if (optionNameIs (option, "next_all_key") ||
+		 optionNameIs (option, "prev_all_key"))
+	{
+	    CCSSettingKeyValue keyVal;
+
+	    if (!ccsGetKey (setting, &keyVal))
+		break;
+
+	    if (keyVal.keysym == 0 && keyVal.keyModMask == 0)
+		break;
+
+	    CCSKeyToKde (cFiles, setting, option);
+
+	    writeKdeEntry (cFiles, FileKwin, "TabBox", "TraverseAll", true);
+	    writeKdeEntry (cFiles, FileKwin, "Windows", "AltTabStyle",
+			   QString ("KDE"));
+	}
+	else if (optionNameIs (option, "next_no_popup_key") ||
+		 optionNameIs (option, "prev_no_popup_key"))
+	{
+	    CCSSettingKeyValue keyVal;
+
+	    if (!ccsGetKey (setting, &keyVal))
+		break;
+
+	    if (keyVal.keysym == 0 && keyVal.keyModMask == 0)
+		break;
+
+	    CCSKeyToKde (cFiles, setting, option);
+
+	    writeKdeEntry (cFiles, FileKwin, "Windows", "AltTabStyle",
+			   QString ("CDE"));
+	}
+	else if (optionNameIs (option, "edge_flip_window") ||
+		 optionNameIs (option, "edgeflip_move") ||
+		 optionNameIs (option, "edge_flip_pointer") ||
+		 optionNameIs (option, "edgeflip_pointer"))
+	    cFiles->derived |= DeriveElectricBorders;
+	else if (optionNameIs (option, "mode") &&
+		 optionPluginIs (option, "place"))
+	{
+	    int     val;
+	    QString mode;
+
+	    if (!ccsGetInt (setting, &val))
+		break;
+
+	    switch (val)
+	    {
+	    case 0:
+		mode = "Cascade";
+		break;
+	    case 1:
+		mode = "Centered";
+		break;
+	    case 2:
+		mode = "Smart";
+		break;
+	    case 3:
+		mode = "Maximizing";
+		break;
+	    case 4:
+		mode = "Random";
+		break;
+	    default:
+		break;
+	    }
+
+	    if (!mode.isEmpty ())
+		writeKdeEntry (cFiles, FileKwin, "Windows", "Placement", mode);
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+
+static void
+writeSetting (CCSContext *c,
+	      CCSSetting *setting)
+{
+    ConfigFiles *cFiles = filesForContext (c);
+
+    QString key = internName (setting->name);
+    QString group = settingGroup (setting);
+
+    if (ccsGetIntegrationEnabled (c) && isIntegratedOption (setting) )
+    {
+	writeIntegratedOption (cFiles, setting);
+	return;
+    }
 
-    if (key & Qt::ShiftModifier)
-	kdeKeymod |= ShiftMask;
+    KConfigGroup cfg = mainConfig (cFiles)->group (group);
 
-    if (key & Qt::ControlModifier)
-	kdeKeymod |= ControlMask;
+    markDirty (cFiles, FileMain, group, key);
 
-    if (key & Qt::AltModifier)
-	kdeKeymod |= CompAltMask;
+    FormatBuffer entry;
 
-    if (key & Qt::MetaModifier)
-	kdeKeymod |= CompSuperMask;
+    if (encodeSetting (setting, entry))
+	cfg.writeEntry (key, QByteArray (entry.constData (), entry.size ()));
+}
 
-    keySet.keysym = XStringToKeysym(KShortcut (key & 0x1FFFFFF).toString ()
-				    .toAscii ().constData ());
-    keySet.keyModMask = kdeKeymod;
-    ccsSetKey (setting, keySet);
+typedef struct _KdeKeyIndexes
+{
+    KdeKeyIndex files[N_FILES];
 }
+KdeKeyIndexes;
 
-static void
-readIntegratedOption (CCSSetting   *setting,
-		      KConfigGroup *mcg)
+static KdeKeyIndexes
+buildKdeKeyIndexes ()
 {
-    int option = 0;
-    KConfigGroup g;
+    KdeKeyIndexes index;
 
     for (unsigned int i = 0; i < N_SOPTIONS; i++)
     {
-	if (setting->name == specialOptions[i].settingName &&
-	    QString (setting->parent->name) == specialOptions[i].pluginName)
+	KdeKey key (specialOptions[i].groupName, specialOptions[i].kdeName);
+
+	switch (specialOptions[i].type)
 	{
-	    option = i;
+	case OptionInt:
+	case OptionBool:
+	    index.files[FileKwin][key].append (i);
+	    break;
+	case OptionKey:
+	    index.files[FileShortcuts][key].append (i);
+	    break;
+	default:
 	    break;
 	}
     }
 
-    switch (specialOptions[option].type)
+    for (unsigned int i = 0; i < N_SDEPENDENCIES; i++)
     {
+	KdeKey key ("Windows", specialDependencies[i].kdeName);
 
-    case OptionInt:
-	KdeIntToCCS (setting, option);
-	break;
-
-    case OptionBool:
-	KdeBoolToCCS (setting, option);
-	break;
-
-    case OptionKey:
-	KdeKeyToCCS (setting, option);
-	break;
-
-    case OptionSpecial:
-	if (specialOptions[option].settingName == "command11")
+	for (unsigned int j = 0; j < N_SOPTIONS; j++)
 	{
-	    ccsSetString (setting, "xkill");
+	    if (optionNameIs (j, specialDependencies[i].settingName) &&
+		optionPluginIs (j, specialDependencies[i].pluginName))
+		index.files[FileKwin][key].append (j);
 	}
-	else if (specialOptions[option].settingName == "unmaximize_window_key"
-		 || specialOptions[option].settingName == "maximize_window_key"
-		 || specialOptions[option].settingName == "maximize_window_horizontally_key"
-		 || specialOptions[option].settingName == "maximize_window_vertically_key")
-	{
-	    CCSSettingKeyValue keyVal;
+    }
 
-	    if (!ccsGetKey (setting, &keyVal) )
-		break;
+    return index;
+}
 
-	    keyVal.keysym = 0;
+/* the option tables are static data, so the index is built once, by
+   whichever context needs it first */
+static const KdeKeyIndex &
+kdeKeyIndex (ConfigFileId file)
+{
+    static const KdeKeyIndexes index = buildKdeKeyIndexes ();
 
-	    keyVal.keyModMask = 0;
+    return index.files[file];
+}
 
-	    ccsSetKey (setting, keyVal);
-	}
-	else if (specialOptions[option].settingName == "click_to_focus")
-	{
-	    Bool val = (cFiles->kwin->group ("Windows").
-		        readEntry ("FocusPolicy") == "ClickToFocus") ?
-		        TRUE : FALSE;
-	    ccsSetBool (setting, val);
-	}
-	else if (specialOptions[option].settingName == "mode" &&
-		 specialOptions[option].pluginName == "resize")
-	{
-	    QString mode = cFiles->kwin->group ("Windows").
-			   readEntry ("ResizeMode");
-	    int     imode = -1;
-	    int     result = 0;
+static KdeValues
+readKdeValues (ConfigFiles  *cFiles,
+	       ConfigFileId file)
+{
+    KdeValues                   values;
+    const KdeFile               *kf = kdeFile (cFiles, file);
+    const KdeKeyIndex           &index = kdeKeyIndex (file);
+    KdeKeyIndex::const_iterator it;
 
-	    if (mcg->hasKey (specialOptions[option].settingName +
-			     " (Integrated)"))
-		imode = mcg->readEntry (specialOptions[option].settingName + 
-				        " (Integrated)", int (0));
+    for (it = index.constBegin (); it != index.constEnd (); it++)
+	values.insert (it.key (), readKdeString (kf, it.key ().first,
+						 it.key ().second));
 
-	    if (mode == "Opaque")
-	    {
-		result = 0;
+    return values;
+}
 
-		if (imode == 3)
-		    result = 3;
-	    }
-	    else if (mode == "Transparent")
-	    {
-		result = 1;
+static void
+collectChangedOptions (ConfigFiles     *cFiles,
+		       ConfigFileId    file,
+		       const KdeValues &oldValues,
+		       QSet<int>       &options)
+{
+    KdeValues                   values = readKdeValues (cFiles, file);
+    const KdeKeyIndex           &index = kdeKeyIndex (file);
+    KdeKeyIndex::const_iterator it;
 
-		if (imode == 2)
-		    result = 2;
-	    }
+    for (it = index.constBegin (); it != index.constEnd (); it++)
+    {
+	if (values.value (it.key ()) == oldValues.value (it.key ()))
+	    continue;
 
-	    ccsSetInt (setting, result);
-	}
-	else if (specialOptions[option].settingName == "snap_type")
-	{
-	    static int intList[2] = {0, 1};
-	    CCSSettingValueList list = ccsGetValueListFromIntArray (intList, 2,
-								    setting);
-	    ccsSetList (setting, list);
-	    ccsSettingValueListFree (list, TRUE);
-	}
-	else if (specialOptions[option].settingName == "resistance_distance" ||
-		 specialOptions[option].settingName == "attraction_distance")
-	{
-	    int val1 = 
-		cFiles->kwin->group ("Windows").
-		    readEntry ("WindowSnapZone", int (0));
-	    int val2 = 
-		cFiles->kwin->group ("Windows").
-		    readEntry ("BorderSnapZone", int (0));
-	    int result = qMax (val1, val2);
+	foreach (int option, it.value ())
+	    options.insert (option);
+    }
+}
 
-	    if (result == 0)
-		result = mcg->readEntry ("snap_distance (Integrated)", int (0));
+static void
+rereadOptions (CCSContext      *context,
+	       const QSet<int> &options)
+{
+    resetBindingCache (NULL);
 
-	    if (result > 0)
-	    	ccsSetInt (setting, result);
-	}
-	else if (specialOptions[option].settingName == "edges_categories")
-	{
-	    int val1 = 
-		cFiles->kwin->group ("Windows").
-		    readEntry ("WindowSnapZone", int (0));
-	    int val2 = 
-		cFiles->kwin->group ("Windows").
-		    readEntry ("BorderSnapZone", int (0));
-	    int intList[2] = {0, 0};
-	    int num = 0;
+    foreach (int option, options)
+    {
+	CCSPlugin *plugin = ccsFindPlugin (context,
+					   specialOptions[option].pluginName);
 
-	    if (val2 > 0)
-		num++;
-	    if (val1 > 0)
-	    {
-		intList[num] = 1;
-		num++;
-	    }
+	if (!plugin)
+	    continue;
 
-	    CCSSettingValueList list = ccsGetValueListFromIntArray (intList,
-								    num,
-								    setting);
-	    ccsSetList (setting, list);
-	    ccsSettingValueListFree (list, TRUE);
-	}
-	else if (specialOptions[option].settingName == "edge_flip_window" ||
-		 specialOptions[option].settingName == "edgeflip_move")
+	for (CCSSettingList l = plugin->settings; l; l = l->next)
 	{
-	    int val = 
-		cFiles->kwin->group ("Windows").
-		    readEntry ("ElectricBorders", int (0));
-
-	    if (val > 0)
-		ccsSetBool (setting, TRUE);
-	    else
-		ccsSetBool (setting, FALSE);
+	    if (optionNameIs (option, l->data->name))
+		readSetting (context, l->data);
 	}
-	else if (specialOptions[option].settingName == "edge_flip_pointer" ||
-		 specialOptions[option].settingName == "edgeflip_pointer")
-	{
-	    int val = 
-		cFiles->kwin->group ("Windows").
-		    readEntry ("ElectricBorders", int (0));
+    }
 
-	    if (val > 1)
-		ccsSetBool (setting, TRUE);
-	    else
-		ccsSetBool (setting, FALSE);
-	}
-	else if (specialOptions[option].settingName == "mode" &&
-		 specialOptions[option].pluginName == "place")
+    resetBindingCache ("reload");
+}
+
+/* the profile feeds every setting except the integrated ones that are
+   read from the KDE files alone */
+static void
+rereadProfileSettings (CCSContext *context)
+{
+    bool integrated = ccsGetIntegrationEnabled (context);
+
+    resetBindingCache (NULL);
+
+    for (CCSPluginList p = context->plugins; p; p = p->next)
+    {
+	for (CCSSettingList l = p->data->settings; l; l = l->next)
 	{
-	    QString mode = cFiles->kwin->group ("Windows").
-			   readEntry ("Placement");
-	    int     result = 0;
+	    int option = (integrated) ? findSpecialOption (l->data) : -1;
 
-	    if (mode == "Smart")
-		result = 2;
-	    else if (mode == "Maximizing")
-		result = 3;
-	    else if (mode == "Cascade")
-		result = 0;
-	    else if (mode == "Random")
-		result = 4;
-	    else if (mode == "Centered")
-		result = 1;
+	    if (option >= 0 && specialOptions[option].type != OptionSpecial)
+		continue;
 
-	    ccsSetInt (setting, result);
+	    readSetting (context, l->data);
 	}
-	break;
-
-    default:
-	break;
     }
+
+    resetBindingCache ("reload");
 }
 
-static Bool
-getSettingIsIntegrated (CCSSetting *setting)
+/* The journal holds one "group<TAB>key<TAB>value" line per written key,
+   value being the raw KConfig entry, and is replayed over the profile
+   every time that is (re)loaded. Appends and compaction hold an flock
+   on the journal so they never interleave; compaction only holds it to
+   move the entries over to the pending file next to the journal, which
+   loadJournal () replays first, and folds them into the profile after. */
+static QString
+journalPath (ConfigFiles *cFiles)
 {
-    return ccsGetIntegrationEnabled (setting->parent->context)
-	   && isIntegratedOption (setting);
+    return filePath (cFiles, FileMain) + JOURNAL_SUFFIX;
 }
 
-
-static Bool
-getSettingIsReadOnly (CCSSetting *setting)
+static QByteArray
+escapeJournalField (const QString &field)
 {
-    if (!ccsGetIntegrationEnabled (setting->parent->context)
-	|| !isIntegratedOption (setting) )
-	return FALSE;
+    QByteArray utf8 = field.toUtf8 ();
+    QByteArray escaped;
 
-    int option = 0;
+    escaped.reserve (utf8.size ());
 
-    for (unsigned int i = 0; i < N_SOPTIONS; i++)
+    for (int i = 0; i < utf8.size (); i++)
     {
-	if (setting->name == specialOptions[i].settingName &&
-	    QString (setting->parent->name) == specialOptions[i].pluginName)
+	switch (utf8[i])
 	{
-	    option = i;
+	case '\\':
+	    escaped += "\\\\";
+	    break;
+	case '\t':
+	    escaped += "\\t";
+	    break;
+	case '\n':
+	    escaped += "\\n";
+	    break;
+	default:
+	    escaped += utf8[i];
 	    break;
 	}
     }
 
-    switch (specialOptions[option].type)
+    return escaped;
+}
+
+static QString
+unescapeJournalField (const QByteArray &field)
+{
+    QByteArray utf8;
+
+    utf8.reserve (field.size ());
+
+    for (int i = 0; i < field.size (); i++)
     {
-    case OptionSpecial:
-	if (specialOptions[option].settingName == "command11")
-	{
-	    return TRUE;
-	}
-	else if (specialOptions[option].settingName == "map_on_shutdown")
-	{
-	    return TRUE;
-	}
-	else if (specialOptions[option].settingName == "unmaximize_window_key"
-		 || specialOptions[option].settingName == "maximize_window_key"
-		 || specialOptions[option].settingName == "maximize_window_horizontally_key"
-		 || specialOptions[option].settingName == "maximize_window_vertically_key")
+	if (field[i] != '\\' || i + 1 == field.size ())
 	{
-	    return TRUE;
+	    utf8 += field[i];
+	    continue;
 	}
-	else if (specialOptions[option].settingName == "snap_type" ||
-		 specialOptions[option].settingName == "attraction_distance")
+
+	switch (field[++i])
 	{
-	    return TRUE;
+	case 't':
+	    utf8 += '\t';
+	    break;
+	case 'n':
+	    utf8 += '\n';
+	    break;
+	default:
+	    utf8 += field[i];
+	    break;
 	}
-	break;
-
-    default:
-	break;
     }
 
-    return FALSE;
+    return QString::fromUtf8 (utf8);
 }
 
-static CCSStringList
-getExistingProfiles (CCSContext *)
+static int
+applyJournal (const QByteArray &data,
+	      KConfig          *config)
 {
-    QDir dir (KGlobal::dirs()->saveLocation ("config", QString::null, false),
-	      				     "compizrc.*");
-
-    QStringList files = dir.entryList();
-    CCSStringList ret = NULL;
+    QList<QByteArray> lines = data.split ('\n');
+    int               entries = 0;
 
-    QStringList::iterator it;
+    /* whatever follows the last newline is an append that did not finish */
+    lines.removeLast ();
 
-    for (it = files.begin(); it != files.end(); it++)
+    foreach (const QByteArray &line, lines)
     {
-	QString str = (*it);
+	QList<QByteArray> fields = line.split ('\t');
 
-	if (str.length() > 9)
-	{
-	    QString profile = str.right (str.length() - 9);
+	if (fields.count () != 3)
+	    continue;
 
-	    if (!profile.isEmpty() )
-		ret = ccsStringListAppend (ret, 
-		    strdup (profile.toAscii().constData()));
-	}
+	config->group (unescapeJournalField (fields[0])).
+	    writeEntry (unescapeJournalField (fields[1]),
+			unescapeJournalField (fields[2]));
+	entries++;
     }
 
-    return ret;
+    return entries;
+}
+
+static QByteArray
+md5 (const QByteArray &data)
+{
+    return QCryptographicHash::hash (data, QCryptographicHash::Md5);
+}
+
+static QString
+pendingPath (const QString &journal)
+{
+    return journal + COMPACTION_SUFFIX;
 }
 
 static void
-readSetting (CCSContext *c,
-	     CCSSetting *setting)
+compactJournal (const QString    &base,
+		const QString    &journal,
+		CompactionHashes *hashes)
 {
-    QString key (setting->name);
-    QString group (setting->parent->name);
+    QFile pending (pendingPath (journal));
+    QFile f (journal);
 
-    if (setting->isScreen)
-    {
-	group += "_screen";
-	group += QString::number (setting->screenNum);
-    }
-    else
-	group += "_display";
+    if (!pending.open (QIODevice::ReadWrite) ||
+	!f.open (QIODevice::ReadWrite))
+	return;
 
-    KConfigGroup cfg = cFiles->main->group (group);
+    /* one compaction at a time, appends only wait for the journal */
+    flock (pending.handle (), LOCK_EX);
+    flock (f.handle (), LOCK_EX);
 
-    if (ccsGetIntegrationEnabled (c) && isIntegratedOption (setting) )
+    QByteArray data  = f.readAll ();
+    bool       moved = pending.seek (pending.size ()) &&
+		       pending.write (data) == data.size () &&
+		       pending.flush () && fdatasync (pending.handle ()) == 0;
+
+    if (moved && !data.isEmpty ())
     {
-	readIntegratedOption (setting, &cfg);
-	return;
+	QMutexLocker locker (&hashes->lock);
+
+	hashes->journalBefore = md5 (data);
+	hashes->journalAfter  = md5 (QByteArray ());
+	f.resize (0);
     }
 
-    if (!cfg.hasKey (key) )
+    flock (f.handle (), LOCK_UN);
+
+    pending.seek (0);
+    data = pending.readAll ();
+
+    if (!moved || data.isEmpty ())
     {
-	ccsResetToDefault (setting);
+	flock (pending.handle (), LOCK_UN);
 	return;
     }
 
-    switch (setting->type)
-    {
+    /* the profile is rewritten to a file of its own and renamed over the
+       old one once its hash is published */
+    QString    staged = base + COMPACTION_SUFFIX;
+    QFile      in (base);
+    QFile      out (staged);
+    QByteArray old;
 
-    case TypeString:
-	ccsSetString (setting, cfg.readEntry (key, "").toAscii ().constData ());
-	break;
+    if (in.open (QIODevice::ReadOnly))
+	old = in.readAll ();
 
-    case TypeMatch:
-	ccsSetMatch (setting, cfg.readEntry (key, "").toAscii ().constData ());
-	break;
+    bool done = out.open (QIODevice::WriteOnly | QIODevice::Truncate) &&
+		out.write (old) == old.size ();
 
-    case TypeFloat:
-	ccsSetFloat (setting, cfg.readEntry (key, double(0.0)));
-	break;
+    if (in.exists ())
+	out.setPermissions (in.permissions ());
 
-    case TypeInt:
-	ccsSetInt (setting, cfg.readEntry (key, int(0)));
-	break;
+    out.close ();
 
-    case TypeBool:
-	{
-	    Bool val = (cfg.readEntry (key, false)) ? TRUE : FALSE;
-	    ccsSetBool (setting, val);
-	}
-	break;
+    if (done)
+    {
+	QMutexLocker locker (&kdeDirsLock ());
+	KConfig      config (staged, KConfig::SimpleConfig);
 
-    case TypeColor:
-	{
-	    CCSSettingColorValue color;
-	    QString value = cfg.readEntry (key, "");
+	applyJournal (data, &config);
+	config.sync ();
 
-	    if (ccsStringToColor (value.toAscii ().constData (), &color))
-		ccsSetColor (setting, color);
-	}
-	break;
+	done = out.open (QIODevice::ReadOnly) &&
+	       fdatasync (out.handle ()) == 0;
+    }
 
-    case TypeList:
-	{
-	    switch (setting->info.forList.listType)
-	    {
+    if (done)
+    {
+	QMutexLocker locker (&hashes->lock);
 
-	    case TypeBool:
-		{
-		    QList<bool> list = cfg.readEntry (key, QList<bool> ());
-		    Bool array[list.count ()];
-		    int i = 0;
-
-		    foreach (Bool val, list)
-		    {
-			array[i] = (val) ? TRUE : FALSE;
-			i++;
-		    }
-
-		    CCSSettingValueList l =
-			ccsGetValueListFromBoolArray (array, i, setting);
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
-		}
-		break;
+	hashes->mainBefore = md5 (old);
+	hashes->mainAfter  = md5 (out.readAll ());
+    }
 
-	    case TypeInt:
-		{
-		    QList<int> list = cfg.readEntry (key, QList<int> ());
-		    int array[list.count ()];
-		    int i = 0;
-
-		    foreach (int val, list)
-		    {
-			array[i] = val;
-			i++;
-		    }
-
-		    CCSSettingValueList l =
-			ccsGetValueListFromIntArray (array, i, setting);
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
-		}
-		break;
+    out.close ();
+
+    if (done && !rename (QFile::encodeName (staged).constData (),
+			 QFile::encodeName (base).constData ()))
+    {
+	/* under the journal lock, so loadJournal () never reads it
+	   half way between the two */
+	flock (f.handle (), LOCK_EX);
+	pending.resize (0);
+	flock (f.handle (), LOCK_UN);
+    }
+    else
+	QFile::remove (staged);
+
+    flock (pending.handle (), LOCK_UN);
+}
+
+/* our own compaction changes nothing we have not loaded already, the
+   hashes it published let reloadFile () skip the files it wrote */
+static void
+takeCompaction (ConfigFiles *cFiles)
+{
+    CompactionHashes *hashes = &cFiles->compacted;
+    QMutexLocker     locker (&hashes->lock);
+
+    if (!hashes->journalBefore.isEmpty () &&
+	cFiles->journalHash == hashes->journalBefore)
+	cFiles->journalHash = hashes->journalAfter;
 
-	    case TypeString:
-		{
-		    QStringList list = cfg.readEntry (key, QStringList ());
+    if (!hashes->mainBefore.isEmpty () &&
+	cFiles->fileHash[FileMain] == hashes->mainBefore)
+	cFiles->fileHash[FileMain] = hashes->mainAfter;
 
-		    if (!list.count ())
-			break;
+    hashes->journalBefore.clear ();
+    hashes->journalAfter.clear ();
+    hashes->mainBefore.clear ();
+    hashes->mainAfter.clear ();
+}
 
-		    char *array[list.count ()];
-		    int i = 0;
+static void
+loadJournal (ConfigFiles *cFiles)
+{
+    QFile f (journalPath (cFiles));
 
-		    foreach (QString val, list)
-		    {
-			array[i] = strdup (val.toAscii ().constData ());
-			i++;
-		    }
+    if (cFiles->store || !f.open (QIODevice::ReadOnly))
+	return;
 
-		    CCSSettingValueList l =
-			ccsGetValueListFromStringArray (array, i, setting);
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
+    QFile pending (pendingPath (journalPath (cFiles)));
 
-		    for (int j = 0; j < i; j++)
-			free (array[j]);
-		}
-		break;
+    flock (f.handle (), LOCK_SH);
 
-	    case TypeMatch:
-		{
-		    QStringList list = cfg.readEntry (key, QStringList ());
+    /* entries a compaction has not folded into the profile yet are
+       older than those still in the journal */
+    QByteArray data;
 
-		    if (!list.count ())
-			break;
+    if (pending.open (QIODevice::ReadOnly))
+	data = pending.readAll ();
 
-		    char *array[list.count ()];
-		    int i = 0;
+    data += f.readAll ();
 
-		    foreach (QString val, list)
-		    {
-			array[i] = strdup (val.toAscii ().constData ());
-			i++;
-		    }
+    flock (f.handle (), LOCK_UN);
+    f.close ();
 
-		    CCSSettingValueList l =
-			ccsGetValueListFromStringArray (array, i, setting);
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
+    if (data.isEmpty () || !applyJournal (data, mainConfig (cFiles)))
+	return;
 
-		    for (int j = 0; j < i; j++)
-			free (array[j]);
-		}
-		break;
+    /* the entries are on disk already, just not in the profile file */
+    cFiles->main->markAsClean ();
 
-	    case TypeFloat:
-		{
-		    QList<float> list = cfg.readEntry (key, QList<float> ());
-		    float array[list.count ()];
-		    int   i = 0;
-
-		    foreach (float val, list)
-		    {
-			array[i] = val;
-			i++;
-		    }
-
-		    CCSSettingValueList l =
-			ccsGetValueListFromFloatArray (array, i, setting);
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
-		}
-		break;
+    if (cFiles->commitMode != CommitJournal)
+	compactJournal (filePath (cFiles, FileMain), journalPath (cFiles),
+			&cFiles->compacted);
+}
 
-	    case TypeColor:
-		{
-		    QStringList list = cfg.readEntry (key, QStringList ());
-		    CCSSettingColorValue array[list.count ()];
-		    int i = 0;
-
-		    foreach (QString val, list)
-		    {
-			if (!ccsStringToColor (val.toAscii ().constData (),
-					       &array[i]))
-			{
-			    memset (&array[i], 0,
-				    sizeof (CCSSettingColorValue));
-			    array[i].color.alpha = 0xffff;
-			}
-			i++;
-		    }
-
-		    CCSSettingValueList l =
-			ccsGetValueListFromColorArray (array, i, setting);
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
-		}
-		break;
+static bool
+appendJournal (ConfigFiles *cFiles)
+{
+    QByteArray data;
 
-	    case TypeKey:
-		{
-		    QStringList list = cfg.readEntry (key, QStringList ());
-
-		    CCSSettingValue     *sVal = NULL;
-		    CCSSettingValueList l = NULL;
-
-		    foreach (QString val, list)
-		    {
-			sVal = (CCSSettingValue*) malloc (sizeof (CCSSettingValue));
-			if (!sVal)
-			    break;
-			if (ccsStringToKeyBinding (val.toAscii ().constData (),
-			    			   &sVal->value.asKey))
-			    l = ccsSettingValueListAppend (l, sVal);
-			else
-			    free (sVal);
-		    }
-
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
-		}
-		break;
-	    case TypeButton:
-		{
-		    QStringList list = cfg.readEntry (key, QStringList ());
-
-		    CCSSettingValue     *sVal = NULL;
-		    CCSSettingValueList l = NULL;
-
-		    foreach (QString val, list)
-		    {
-			sVal = (CCSSettingValue*) malloc (sizeof (CCSSettingValue));
-			if (!sVal)
-			    break;
-			if (ccsStringToButtonBinding (
-				val.toAscii ().constData (),
-				&sVal->value.asButton))
-			    l = ccsSettingValueListAppend (l, sVal);
-			else
-			    free (sVal);
-		    }
-
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
-		}
-		break;
-	    case TypeEdge:
-		{
-		    QStringList list = cfg.readEntry (key, QStringList ());
-
-		    CCSSettingValue     *sVal = NULL;
-		    CCSSettingValueList l = NULL;
-
-		    foreach (QString val, list)
-		    {
-			sVal = (CCSSettingValue*) malloc (sizeof (CCSSettingValue));
-			if (!sVal)
-			    break;
-			sVal->value.asEdge =
-			    ccsStringToEdges (val.toAscii ().constData ());
-			l = ccsSettingValueListAppend (l, sVal);
-		    }
-
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
-		}
-		break;
-	    case TypeBell:
-		{
-		    QList<bool> list = cfg.readEntry (key, QList<bool> ());
-
-		    CCSSettingValue     *sVal = NULL;
-		    CCSSettingValueList l = NULL;
-
-		    foreach (bool val, list)
-		    {
-			sVal = (CCSSettingValue*) malloc (sizeof (CCSSettingValue));
-			if (!sVal)
-			    break;
-			sVal->value.asBell = (val) ? TRUE : FALSE;
-			l = ccsSettingValueListAppend (l, sVal);
-		    }
-
-		    ccsSetList (setting, l);
-		    ccsSettingValueListFree (l, TRUE);
-		}
-		break;
+    QHash<QString, QSet<QString> >::const_iterator it;
 
-	    default:
-		break;
-	    }
-	}
-	break;
+    for (it = cFiles->dirty[FileMain].constBegin ();
+	 it != cFiles->dirty[FileMain].constEnd (); it++)
+    {
+	KConfigGroup g = cFiles->main->group (it.key ());
 
-    case TypeKey:
+	foreach (const QString &key, it.value ())
 	{
-	    QString str = cfg.readEntry (key, QString ());
-
-	    CCSSettingKeyValue value;
+	    data += escapeJournalField (it.key ());
+	    data += '\t';
+	    data += escapeJournalField (key);
+	    data += '\t';
+	    data += escapeJournalField (g.readEntry (key, QString ()));
+	    data += '\n';
+	}
+    }
 
-	    ccsStringToKeyBinding (str.toAscii ().constData (), &value);
+    int fd = open (QFile::encodeName (journalPath (cFiles)).constData (),
+		   O_WRONLY | O_APPEND | O_CREAT, 0600);
 
-	    ccsSetKey (setting, value);
-	}
-	break;
-    case TypeButton:
-	{
-	    QString str = cfg.readEntry (key, QString ());
+    if (fd < 0)
+	return false;
 
-	    CCSSettingButtonValue value;
+    flock (fd, LOCK_EX);
 
-	    ccsStringToButtonBinding (str.toAscii ().constData (), &value);
+    bool  written = write (fd, data.constData (), data.size ()) ==
+		    (ssize_t) data.size () && fdatasync (fd) == 0;
+    off_t size    = lseek (fd, 0, SEEK_END);
 
-	    ccsSetButton (setting, value);
-	}
-	break;
-    case TypeEdge:
-	{
-	    QString str = cfg.readEntry (key, QString ());
+    flock (fd, LOCK_UN);
+    close (fd);
 
-	    unsigned int value;
+    if (!written)
+	return false;
 
-	    value = ccsStringToEdges (str.toAscii ().constData ());
+    cFiles->main->markAsClean ();
 
-	    ccsSetEdge (setting, value);
-	}
-	break;
-    case TypeBell:
-	{
-	    Bool val = (cfg.readEntry (key, false)) ? TRUE : FALSE;
-	    ccsSetBell (setting, val);
-	}
-	break;
+    if (size >= cFiles->journalLimit && !cFiles->compaction.isRunning ())
+	cFiles->compaction = QtConcurrent::run (compactJournal,
+						filePath (cFiles, FileMain),
+						journalPath (cFiles),
+						&cFiles->compacted);
 
-    default:
-	kDebug () << "Not supported setting type : " << setting->type << endl;
-	break;
-    }
+    return true;
 }
 
-static void
-CCSIntToKde (CCSSetting *setting,
-	     int        num)
+static QByteArray
+contentHash (const QString &path)
 {
-    KConfigGroup g = cFiles->kwin->group (specialOptions[num].groupName);
+    QFile f (path);
 
-    int val;
+    if (!f.open (QIODevice::ReadOnly))
+	return QByteArray ();
 
-    if (!ccsGetInt (setting, &val) )
-	return;
+    return md5 (f.readAll ());
+}
 
-    if (g.readEntry (specialOptions[num].kdeName, ~val) != val)
-    {
-	cFiles->modified = true;
-	g.writeEntry (specialOptions[num].kdeName, val);
-    }
+static QByteArray
+fileHash (ConfigFiles  *cFiles,
+	  ConfigFileId file)
+{
+    if (file == FileMain && cFiles->store)
+	return storeGeneration (cFiles->store);
+
+    return contentHash (filePath (cFiles, file));
 }
 
 static void
-CCSBoolToKde (CCSSetting *setting,
-	      int        num)
+recordFileHash (ConfigFiles  *cFiles,
+		ConfigFileId file)
 {
-    KConfigGroup g = cFiles->kwin->group (specialOptions[num].groupName);
-
-    Bool val;
+    cFiles->fileHash[file] = fileHash (cFiles, file);
+}
 
-    if (!ccsGetBool (setting, &val) )
-	return;
+static void
+recordJournalHash (ConfigFiles *cFiles)
+{
+    if (cFiles->commitMode == CommitJournal && !cFiles->store)
+	cFiles->journalHash = contentHash (journalPath (cFiles));
+}
 
-    if (g.readEntry (specialOptions[num].kdeName, bool (~val)) != bool (val) )
+static ProfileSnapshot *
+loadSnapshot (ConfigFiles *cFiles)
+{
+    if (!cFiles->main)
     {
-	cFiles->modified = true;
-	g.writeEntry (specialOptions[num].kdeName, bool (val) );
+	ProfileSnapshot *snapshot =
+	    parseProfileFile (filePath (cFiles, FileMain));
+
+	if (snapshot)
+	    return snapshot;
     }
+
+    return buildSnapshot (mainConfig (cFiles));
 }
 
-static void
-CCSKeyToKde (CCSSetting *setting,
-	     int        num)
+static QByteArray
+layersHash (ConfigFiles *cFiles)
 {
+    QByteArray hash;
 
-    CCSSettingKeyValue keyVal;
-
-    if (!ccsGetKey (setting, &keyVal) )
-        return;
-
-    int key = QKeySequence (XKeysymToString (keyVal.keysym));
+    foreach (const QString &layer, cFiles->layers)
+	hash += contentHash (layer);
 
-    if (keyVal.keyModMask & ShiftMask)
-	key |= Qt::ShiftModifier;
+    return hash;
+}
 
-    if (keyVal.keyModMask & ControlMask)
-	key |= Qt::ControlModifier;
+/* false if the file still holds what we last loaded or wrote, like for
+   the events of our own writes or a plain touch */
+static bool
+watchedFileChanged (ConfigFiles *cFiles,
+		    WatchedFile file)
+{
+    QByteArray *hash;
+    QByteArray current;
 
-    if (keyVal.keyModMask & CompAltMask)
-	key |= Qt::AltModifier;
+    switch (file)
+    {
+    case WatchMain:
+	hash    = &cFiles->fileHash[FileMain];
+	current = fileHash (cFiles, FileMain);
+	break;
+    case WatchKwin:
+	hash    = &cFiles->fileHash[FileKwin];
+	current = fileHash (cFiles, FileKwin);
+	break;
+    case WatchShortcuts:
+	hash    = &cFiles->fileHash[FileShortcuts];
+	current = fileHash (cFiles, FileShortcuts);
+	break;
+    case WatchJournal:
+	if (cFiles->commitMode != CommitJournal || cFiles->store)
+	    return false;
+	hash    = &cFiles->journalHash;
+	current = contentHash (journalPath (cFiles));
+	break;
+    case WatchLayers:
+	hash    = &cFiles->layersHash;
+	current = layersHash (cFiles);
+	break;
+    default:
+	return false;
+    }
 
-    if (keyVal.keyModMask & CompSuperMask)
-	key |= Qt::MetaModifier;
+    if (current == *hash)
+	return false;
 
+    *hash = current;
 
-    QStringList keyData = cFiles->shortcuts->
-	group (specialOptions[num].groupName).
-	readEntry (specialOptions[num].kdeName, QStringList());
+    return true;
+}
 
-    if (keyData.size () != 3)
-	return;
+static void
+setWatchesEnabled (ConfigFiles *cFiles,
+		   bool        enabled)
+{
+    QMutexLocker locker (&fileWatchLock ());
 
-    QStringList kl = keyData[0].split (' ');
+    if (enabled)
+	ccsEnableFileWatch (cFiles->dirWatch);
+    else
+	ccsDisableFileWatch (cFiles->dirWatch);
+}
 
-    kl[0] = (key)? QKeySequence(key).toString () : "none";
+static quint64
+timeUsec ()
+{
+    struct timeval tv;
 
-    keyData[0] = kl.join (" ");
+    gettimeofday (&tv, NULL);
 
-    cFiles->shortcuts->group (specialOptions[num].groupName).
-	writeEntry (specialOptions[num].kdeName, keyData);
-    cFiles->modified = true;
+    return (quint64) tv.tv_sec * 1000000 + tv.tv_usec;
 }
 
-
-static void
-writeIntegratedOption (CCSSetting *setting)
+/* false if the file did not change after all */
+static bool
+reloadFile (ConfigFiles *cFiles,
+	    WatchedFile file)
 {
-    int option = 0;
+    CCSContext *context = cFiles->context;
+    quint64    start    = timeUsec ();
 
-    for (unsigned int i = 0; i < N_SOPTIONS; i++)
+    if (!watchedFileChanged (cFiles, file))
     {
-	if (setting->name == specialOptions[i].settingName &&
-	    QString (setting->parent->name) == specialOptions[i].pluginName)
-	{
-	    option = i;
-	    break;
-	}
+	cFiles->skippedReloads++;
+	cFiles->reloadTime += timeUsec () - start;
+	return false;
     }
 
-    QString group (setting->parent->name);
+    setWatchesEnabled (cFiles, false);
 
-    if (setting->isScreen)
+    if (file == WatchKwin || file == WatchShortcuts)
     {
-	group += "_screen";
-	group += QString::number (setting->screenNum);
+	/* only re-read the integrated settings whose KDE keys changed */
+	ConfigFileId id = (file == WatchKwin) ? FileKwin : FileShortcuts;
+	KdeValues    values = readKdeValues (cFiles, id);
+	QSet<int>    options;
+
+	/* readers keep the KdeFile of the snapshot they hold, we are
+	   the only one looking at ours */
+	loadKdeFile (kdeFile (cFiles, id));
+	recordFileHash (cFiles, id);
+
+	invalidateKdeIntegration (cFiles);
+	publishSnapshot (cFiles, copySnapshot (cFiles));
+
+	if (ccsGetIntegrationEnabled (context))
+	    collectChangedOptions (cFiles, id, values, options);
+
+	if (!options.isEmpty ())
+	    rereadOptions (context, options);
     }
     else
-	group += "_display";
+    {
+	/* back to reading the file without KConfig until the next write */
+	kdeDirsLock ().lock ();
 
-    KConfigGroup cfg = cFiles->main->group (group);
+	if (cFiles->mainName.isEmpty ())
+	    cFiles->main->reparseConfiguration();
+	else
+	{
+	    delete cFiles->main;
+	    cFiles->main = NULL;
+	}
 
-    switch (specialOptions[option].type)
-    {
+	kdeDirsLock ().unlock ();
 
-    case OptionInt:
-	CCSIntToKde (setting, option);
-	break;
+	loadJournal (cFiles);
+	recordFileHash (cFiles, FileMain);
+	recordJournalHash (cFiles);
+	cFiles->layersHash = layersHash (cFiles);
 
-    case OptionBool:
-	CCSBoolToKde (setting, option);
-	break;
-    case OptionKey:
-	CCSKeyToKde (setting, option);
-	break;
+	publishSnapshot (cFiles, loadSnapshot (cFiles));
+	rereadProfileSettings (context);
+    }
 
-    case OptionSpecial:
-	if (specialOptions[option].settingName == "command11"
-	    || specialOptions[option].settingName == "unmaximize_window_key"
-	    || specialOptions[option].settingName == "maximize_window_key"
-	    || specialOptions[option].settingName == "maximize_window_horizontally_key"
-	    || specialOptions[option].settingName == "maximize_window_vertically_key")
-	    break;
+    setWatchesEnabled (cFiles, true);
 
-	if (specialOptions[option].settingName == "click_to_focus")
-	{
-	    QString mode = cFiles->kwin->group ("Windows").
-			   readEntry ("FocusPolicy");
-	    QString val = "ClickToFocus";
-	    Bool bVal;
+    cFiles->reloads++;
+    cFiles->reloadTime += timeUsec () - start;
 
-	    if (!ccsGetBool (setting, &bVal) )
-		break;
+    return true;
+}
 
-	    if (!bVal)
-	    {
-		val = "FocusFollowsMouse";
-	    }
+/* which of our files a name in the config directory is, if any */
+static bool
+watchedFileForName (ConfigFiles   *cFiles,
+		    const QString &name,
+		    WatchedFile   *file)
+{
+    if (name == "kwinrc")
+	*file = WatchKwin;
+    else if (name == "kglobalshortcutsrc")
+	*file = WatchShortcuts;
+    else if (!name.startsWith ("compizrc"))
+	return false;
+    else if (name == QFileInfo (filePath (cFiles, FileMain)).fileName ())
+	*file = WatchMain;
+    else if (name == QFileInfo (journalPath (cFiles)).fileName ())
+	*file = WatchJournal;
+    else if (cFiles->layers.contains (cFiles->configDir + name))
+	*file = WatchLayers;
+    else
+	return false;
 
-	    if (mode != val)
-	    {
-		cFiles->modified = true;
-		cFiles->kwin->group ("Windows").writeEntry ("FocusPolicy", val);
-	    }
-	}
-	if (specialOptions[option].settingName == "mode" &&
-	    specialOptions[option].pluginName == "resize")
+    return true;
+}
+
+/* returns the files touched since the last call as WatchedFile bits */
+static unsigned int
+changedFiles (ConfigFiles *cFiles)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    if (cFiles->inotifyFd >= 0)
+    {
+	char         buf[4096]
+	    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+	unsigned int changed = 0;
+	ssize_t      len;
+
+	while ((len = read (cFiles->inotifyFd, buf, sizeof (buf))) > 0)
 	{
-	    QString mode = cFiles->kwin->group ("Windows").
-			   readEntry("ResizeMode");
-	    QString val = "Opaque";
-	    int     iVal;
-	    if (ccsGetInt(setting, &iVal) && (iVal == 1 || iVal == 2))
-	    {
-		val = "Transparent";
-	    }
-	    if (mode != val)
+	    for (char *p = buf; p < buf + len;
+		 p += sizeof (struct inotify_event) +
+		      ((struct inotify_event *) p)->len)
 	    {
-		cFiles->modified = true;
-		cFiles->kwin->group ("Windows").writeEntry("ResizeMode",val);
+		struct inotify_event *event = (struct inotify_event *) p;
+		WatchedFile          file;
+
+		/* events were dropped, so any of the files may have
+		   changed; reloadFile () skips those that did not */
+		if (event->mask & IN_Q_OVERFLOW)
+		{
+		    changed = (1 << N_WATCHED) - 1;
+		    continue;
+		}
+
+		if (!event->len ||
+		    !watchedFileForName (cFiles,
+					 QFile::decodeName (event->name),
+					 &file))
+		    continue;
+
+		/* IN_MODIFY counts as well: libcompizconfig only calls us
+		   for modify, move, create and delete, so the close of an
+		   in-place write that comes after we drained the fd would
+		   not wake us up again. reloadFile () skips the reloads
+		   the content hash shows are duplicates. */
+		changed |= 1 << file;
 	    }
-	    cfg.writeEntry(specialOptions[option].settingName + " (Integrated)",iVal);
 	}
 
-	if (specialOptions[option].settingName == "resistance_distance" ||
-	    specialOptions[option].settingName == "edges_categories")
-	{
-	    int *values, numValues;
-	    CCSSettingValueList sList;
+	return changed;
+    }
+#endif
+
+    return (1 << N_WATCHED) - 1;
+}
 
-	    bool edge = false;
-	    bool window = false;
+/* all the files live in one directory, watching that instead of the
+   files themselves also catches saves that rename a new file over an
+   old one, and a save that touches a temporary file several times is
+   reported once */
+static void
+configDirChanged (unsigned int watchId,
+		  void         *closure)
+{
+    ConfigFiles  *cFiles = (ConfigFiles *) closure;
+    unsigned int changed = changedFiles (cFiles);
 
-	    int iVal = 0;
+    takeCompaction (cFiles);
 
-	    CCSSetting *edges = ccsFindSetting(setting->parent,
-					       "edges_categories",
-					       setting->isScreen,
-					       setting->screenNum);
+    /* the journal and the layers are read along with the profile, if
+       that really changed */
+    if ((changed & (1 << WatchMain)) && reloadFile (cFiles, WatchMain))
+	changed &= ~((1 << WatchJournal) | (1 << WatchLayers));
 
-	    CCSSetting *dist = ccsFindSetting(setting->parent,
-					      "resistance_distance",
-					      setting->isScreen,
-					      setting->screenNum);
+    for (int file = 0; file < N_WATCHED; file++)
+    {
+	if (file != WatchMain && (changed & (1 << file)))
+	    reloadFile (cFiles, (WatchedFile) file);
+    }
+}
 
-	    if (!edges || !dist || !ccsGetList (edges, &sList) ||
-		!ccsGetInt(dist, &iVal))
-		break;
+static void
+watchConfigDir (ConfigFiles *cFiles)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    cFiles->inotifyFd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+
+    if (cFiles->inotifyFd >= 0 &&
+	inotify_add_watch (cFiles->inotifyFd,
+			   QFile::encodeName (cFiles->configDir).constData (),
+			   IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE |
+			   IN_MODIFY) < 0)
+    {
+	close (cFiles->inotifyFd);
+	cFiles->inotifyFd = -1;
+    }
+#else
+    cFiles->inotifyFd = -1;
+#endif
 
-	    values = ccsGetIntArrayFromValueList (sList, &numValues);
+    QMutexLocker locker (&fileWatchLock ());
 
-	    for (int i = 0; i < numValues; i++)
-	    {
-		if (values[i] == 0)
-		    edge = true;
-		if (values[i] == 1)
-		    window = true;
-	    }
+    cFiles->dirWatch =
+	ccsAddFileWatch (QFile::encodeName (cFiles->configDir).constData (),
+			 TRUE, configDirChanged, (void *) cFiles);
+}
 
-	    if (values)
-		free (values);
+static void
+watchJournal (ConfigFiles *cFiles)
+{
+    if (cFiles->commitMode != CommitJournal || cFiles->store)
+	return;
 
-	    if (edge)
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("BorderSnapZone", iVal);
-	    else
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("BorderSnapZone", 0);
+    createFile (journalPath (cFiles));
+    recordJournalHash (cFiles);
+}
 
-	    if (window)
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("WindowSnapZone", iVal);
+/* opens the profile in the storage its backend options ask for, moving
+   it over from the other one if needed */
+static void
+openMain (ConfigFiles   *cFiles,
+	  const QString &configName)
+{
+    QMutexLocker locker (&kdeDirsLock ());
+    QString      iniPath   = cFiles->configDir + configName;
+    QString      storePath = iniPath + STORE_SUFFIX;
+
+    delete cFiles->main;
+    cFiles->main = NULL;
+    cFiles->mainName.clear ();
+    cFiles->dirty[FileMain].clear ();
+    releaseStore (cFiles->store);
+    cFiles->store = NULL;
+    cFiles->layers.clear ();
+
+    if (profileUsesStore (cFiles->profile))
+	cFiles->store = openStore (storePath);
+
+    if (cFiles->store)
+    {
+	if (QFile::exists (iniPath))
+	{
+	    if (importStore (cFiles->store, iniPath))
+		QFile::remove (iniPath);
 	    else
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("WindowSnapZone", 0);
-
-	    if (window | edge)
-		cFiles->modified = true;
-	    cfg.writeEntry ("snap_distance (Integrated)",iVal);
+		kWarning () << "Could not import" << iniPath << endl;
 	}
-	else if (specialOptions[option].settingName == "next_key" ||
-		 specialOptions[option].settingName == "prev_key")
-	{
-	    CCSSettingKeyValue keyVal;
 
-	    if (!ccsGetKey (setting, &keyVal))
-		break;
+	/* only holds what gets written until it is flushed to the store */
+	cFiles->main = new KConfig (QString (), KConfig::SimpleConfig);
 
-	    if (keyVal.keysym == 0 && keyVal.keyModMask == 0)
-		break;
+	return;
+    }
 
-	    CCSKeyToKde (setting, option);
+    if (QFile::exists (storePath))
+    {
+	ProfileStore *store = openStore (storePath);
+	bool         exported = store && exportStore (store, iniPath);
 
-	    cFiles->kwin->group ("TabBox").writeEntry ("TraverseAll", false);
-	    cFiles->kwin->group ("Windows").writeEntry ("AltTabStyle", "KDE");
+	releaseStore (store);
 
-	    cFiles->modified = true;
-	}
-	else if (specialOptions[option].settingName == "next_all_key" ||
-		 specialOptions[option].settingName == "prev_all_key")
-	{
-	    CCSSettingKeyValue keyVal;
+	if (exported)
+	    QFile::remove (storePath);
+	else
+	    kWarning () << "Could not export" << storePath << endl;
+    }
 
-	    if (!ccsGetKey (setting, &keyVal))
-		break;
+    createFile (iniPath);
 
-	    if (keyVal.keysym == 0 && keyVal.keyModMask == 0)
-		break;
+    cFiles->layers = profileLayers (cFiles->configDir, cFiles->profile);
 
-	    CCSKeyToKde (setting, option);
+    if (cFiles->layers.isEmpty ())
+    {
+	cFiles->mainName = configName;
+	return;
+    }
 
-	    cFiles->kwin->group ("TabBox").writeEntry ("TraverseAll", true);
-	    cFiles->kwin->group ("Windows").writeEntry ("AltTabStyle", "KDE");
+    /* keys the profile does not set itself come from its parents, writes
+       only ever go to the profile's own file */
+    cFiles->main = new KConfig (configName);
+    cFiles->main->addConfigSources (cFiles->layers);
+}
 
-	    cFiles->modified = true;
-	}
-	else if (specialOptions[option].settingName == "next_no_popup_key" ||
-		 specialOptions[option].settingName == "prev_no_popup_key")
-	{
-	    CCSSettingKeyValue keyVal;
+static void
+watchLayers (ConfigFiles *cFiles)
+{
+    foreach (const QString &layer, cFiles->layers)
+	createFile (layer);
 
-	    if (!ccsGetKey (setting, &keyVal))
-		break;
+    cFiles->layersHash = layersHash (cFiles);
+}
 
-	    if (keyVal.keysym == 0 && keyVal.keyModMask == 0)
-		break;
+static void
+openProfile (ConfigFiles *cFiles,
+	     CCSContext  *c)
+{
+    if (cFiles->profile == ccsGetProfile (c))
+	return;
 
-	    CCSKeyToKde (setting, option);
+    QString configName ("compizrc");
 
-	    cFiles->kwin->group ("Windows").writeEntry ("AltTabStyle", "CDE");
+    /* openMain () goes by the profile, the default one included */
+    cFiles->profile = ccsGetProfile (c);
 
-	    cFiles->modified = true;
-	}
-	else if (specialOptions[option].settingName == "edge_flip_window" ||
-		 specialOptions[option].settingName == "edgeflip_move")
-	{
-	    int  oVal = cFiles->kwin->group ("Windows").
-			readEntry ("ElectricBorders", 0);
-	    Bool val;
+    if (!cFiles->profile.isEmpty ())
+	configName += "." + cFiles->profile;
 
-	    if (!ccsGetBool (setting, &val))
-		break;
+    openMain (cFiles, configName);
 
-	    if (val)
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("ElectricBorders", qMax (1, oVal));
-	    else
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("ElectricBorders", 0);
-	    cFiles->modified = true;
-	}
-	else if (specialOptions[option].settingName == "edge_flip_pointer" ||
-		 specialOptions[option].settingName == "edgeflip_pointer")
-	{
-	    int  oVal = 0;
-	    Bool val, val2;
+    loadJournal (cFiles);
+    recordFileHash (cFiles, FileMain);
+    publishSnapshot (cFiles, loadSnapshot (cFiles));
 
-	    if (!ccsGetBool (setting, &val))
-		break;
+    watchJournal (cFiles);
+    watchLayers (cFiles);
+}
+
+static Bool
+readInit (CCSContext *c)
+{
+    ConfigFiles *cFiles = filesForContext (c);
+
+    resetBindingCache (NULL);
+    openProfile (cFiles, c);
+
+    /* so the pass sees whatever is in the store now */
+    if (cFiles->store)
+	publishSnapshot (cFiles, copySnapshot (cFiles));
 
-	    CCSSetting *valSet = ccsFindSetting(setting->parent,
-						 "edge_flip_window",
-						 setting->isScreen,
-						 setting->screenNum);
+    return TRUE;
+}
 
-	    if (!valSet)
-	     	valSet = ccsFindSetting(setting->parent, "edgeflip_move",
-					setting->isScreen, setting->screenNum);
+static void
+readDone (CCSContext *)
+{
+    resetBindingCache ("read");
+}
 
-	    if (valSet && ccsGetBool (valSet, &val2))
-	    {
-		if (val2)
-		    oVal = 1;
-	    }
-	    else
-		oVal = 0;
-		
+static Bool
+writeInit (CCSContext *c)
+{
+    ConfigFiles *cFiles = filesForContext (c);
 
-	    if (val)
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("ElectricBorders", 2);
-	    else
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("ElectricBorders", oVal);
-	    cFiles->modified = true;
-	}
-	else if (specialOptions[option].settingName == "mode" &&
-		 specialOptions[option].pluginName == "place")
-	{
-	    int val;
-	    if (!ccsGetInt (setting, &val))
-		break;
+    resetBindingCache (NULL);
+    openProfile (cFiles, c);
 
-	    switch (val)
-	    {
-	    case 0:
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("Placement", "Cascade");
-		break;
-	    case 1:
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("Placement", "Centered");
-		break;
-	    case 2:
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("Placement", "Smart");
-		break;
-	    case 3:
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("Placement", "Maximizing");
-		break;
-	    case 4:
-		cFiles->kwin->group ("Windows").
-		    writeEntry ("Placement", "Random");
-		break;
-	    default:
-		break;
-	    }
+    cFiles->derived = 0;
+    setWatchesEnabled (cFiles, false);
 
-	    cFiles->modified = true;
-	}
-	break;
-    default:
-	break;
-    }
+    return TRUE;
 }
 
+/* files are published in this order, the profile last, so whoever sees
+   the new profile also sees the KDE files written along with it */
+static const ConfigFileId commitOrder[N_FILES] =
+{
+    FileShortcuts,
+    FileKwin,
+    FileMain
+};
 
 static void
-writeSetting (CCSContext *c,
-	      CCSSetting *setting)
+syncFile (ConfigFiles  *cFiles,
+	  ConfigFileId file)
 {
-    QString key (setting->name);
-    QString group (setting->parent->name);
+    QMutexLocker locker (&kdeDirsLock ());
 
-    if (setting->isScreen)
+    if (file == FileMain)
     {
-	group += "_screen";
-	group += QString::number (setting->screenNum);
+	mainConfig (cFiles)->sync ();
+	return;
     }
-    else
-	group += "_display";
 
-    KConfigGroup cfg = cFiles->main->group (group);
+    KdeFile *kf = kdeFile (cFiles, file);
+    QString path = filePath (cFiles, file);
 
-    if (ccsGetIntegrationEnabled (c) && isIntegratedOption (setting) )
-    {
-	writeIntegratedOption (setting);
+    if (!kf->kiosk && saveIniFile (path, path, kf->entries,
+				   cFiles->dirty[file]))
 	return;
-    }
 
-    switch (setting->type)
-    {
+    /* KConfig leaves whatever the kiosk markers lock alone */
+    KConfig config (kf->name, KConfig::NoGlobals);
 
-    case TypeString:
-	{
-	    char * val;
+    QHash<QString, QSet<QString> >::const_iterator it;
 
-	    if (ccsGetString (setting, &val) )
-		cfg.writeEntry (key, QString (val));
-	}
-	break;
+    for (it = cFiles->dirty[file].constBegin ();
+	 it != cFiles->dirty[file].constEnd (); it++)
+    {
+	KConfigGroup g = config.group (it.key ());
 
-    case TypeMatch:
+	foreach (const QString &key, it.value ())
 	{
-	    char * val;
+	    const QByteArray *entry = kdeEntry (kf, it.key (), key);
 
-	    if (ccsGetMatch (setting, &val) )
-		cfg.writeEntry (key, QString (val));
+	    if (entry)
+		g.writeEntry (key, QString::fromUtf8 (*entry));
 	}
-	break;
-
-    case TypeFloat:
-	{
-	    float val;
+    }
 
-	    if (ccsGetFloat (setting, &val) )
-		cfg.writeEntry (key, double(val));
-	}
-	break;
+    config.sync ();
 
-    case TypeInt:
-	{
-	    int val;
+    /* back to what the locked keys really hold */
+    loadKdeFile (kf);
+}
 
-	    if (ccsGetInt (setting, &val) )
-		cfg.writeEntry (key, val);
-	}
-	break;
+static bool
+stageFile (ConfigFiles   *cFiles,
+	   ConfigFileId  file,
+	   const QString &staged)
+{
+    QMutexLocker locker (&kdeDirsLock ());
+    QString      path = filePath (cFiles, file);
 
-    case TypeBool:
-	{
-	    Bool val;
+    QFile::remove (staged);
 
-	    if (ccsGetBool (setting, &val) )
-		cfg.writeEntry (key, bool (val) );
-	}
-	break;
+    if (file != FileMain)
+    {
+	KdeFile *kf = kdeFile (cFiles, file);
 
-    case TypeColor:
-	{
-	    CCSSettingColorValue color;
-	    char *value;
+	/* splice our changes into what is on disk now, syncFile () has
+	   KConfig deal with kiosk markers */
+	if (kf->kiosk || !saveIniFile (path, staged, kf->entries,
+				       cFiles->dirty[file]))
+	    return false;
+    }
+    else
+    {
+	if (QFile::exists (path) && !QFile::copy (path, staged))
+	    return false;
 
-	    if (!ccsGetColor (setting, &color))
-		break;
+	/* replay our changes over what is on disk now, like KConfig::sync */
+	KConfig *live = mainConfig (cFiles);
+	KConfig stage (staged, KConfig::SimpleConfig);
 
-	    value = ccsColorToString (&color);
-	    if (value)
-		cfg.writeEntry (key, QString (value));
-	    free (value);
-	}
-	break;
+	QHash<QString, QSet<QString> >::const_iterator it;
 
-    case TypeList:
+	for (it = cFiles->dirty[file].constBegin ();
+	     it != cFiles->dirty[file].constEnd (); it++)
 	{
-	    switch (setting->info.forList.listType)
-	    {
+	    KConfigGroup from = live->group (it.key ());
+	    KConfigGroup to   = stage.group (it.key ());
 
-	    case TypeBool:
-		{
-		    QList<int> list;
-		    CCSSettingValueList l;
+	    foreach (const QString &key, it.value ())
+		to.writeEntry (key, from.readEntry (key, QString ()));
+	}
 
-		    if (!ccsGetList (setting, &l) )
-			break;
+	stage.sync ();
+    }
 
-		    while (l)
-		    {
-			list.append (l->data->value.asBool);
-			l = l->next;
-		    }
+    QFile f (staged);
 
-		    cfg.writeEntry (key, list);
-		}
-		break;
-		
-	    case TypeInt:
-		{
-		    QList<int> list;
-		    CCSSettingValueList l;
+    if (!f.open (QIODevice::ReadOnly))
+	return false;
 
-		    if (!ccsGetList (setting, &l) )
-			break;
+    return fdatasync (f.handle ()) == 0;
+}
 
-		    while (l)
-		    {
-			list.append (l->data->value.asInt);
-			l = l->next;
-		    }
+static bool
+commitFiles (ConfigFiles *cFiles)
+{
+    QString staged[N_FILES];
+    int     i;
 
-		    cfg.writeEntry (key, list);
-		}
-		break;
+    for (i = 0; i < N_FILES; i++)
+    {
+	ConfigFileId file = commitOrder[i];
 
-	    case TypeString:
-		{
-		    QStringList list;
-		    CCSSettingValueList l;
+	if (cFiles->dirty[file].isEmpty ())
+	    continue;
 
-		    if (!ccsGetList (setting, &l) )
-			break;
+	staged[file] = filePath (cFiles, file) + ".ccs-commit";
 
-		    while (l)
-		    {
-			list.append (l->data->value.asString);
-			l = l->next;
-		    }
+	if (!stageFile (cFiles, file, staged[file]))
+	    break;
+    }
 
-		    cfg.writeEntry (key, list);
-		}
-		break;
+    if (i < N_FILES)
+    {
+	kWarning () << "Could not stage" << staged[commitOrder[i]] <<
+		       ", syncing files one by one" << endl;
 
-	    case TypeMatch:
-		{
-		    QStringList list;
-		    CCSSettingValueList l;
+	for (i = 0; i < N_FILES; i++)
+	    if (!staged[i].isEmpty ())
+		QFile::remove (staged[i]);
 
-		    if (!ccsGetList (setting, &l) )
-			break;
+	return false;
+    }
 
-		    while (l)
-		    {
-			list.append (l->data->value.asMatch);
-			l = l->next;
-		    }
+    for (i = 0; i < N_FILES; i++)
+    {
+	ConfigFileId file = commitOrder[i];
 
-		    cfg.writeEntry (key, list);
-		}
-		break;
+	if (staged[file].isEmpty ())
+	    continue;
 
-	    case TypeFloat:
-		{
-		    QStringList list;
-		    CCSSettingValueList l;
+	if (rename (QFile::encodeName (staged[file]).constData (),
+		    QFile::encodeName (filePath (cFiles, file)).constData ()))
+	{
+	    kWarning () << "Could not publish" << filePath (cFiles, file) << endl;
+	    QFile::remove (staged[file]);
+	    syncFile (cFiles, file);
+	    continue;
+	}
 
-		    if (!ccsGetList (setting, &l) )
-			break;
+	if (file == FileMain)
+	    mainConfig (cFiles)->markAsClean ();
+    }
 
-		    while (l)
-		    {
-			list.append (QString::number (l->data->value.asFloat) );
-			l = l->next;
-		    }
+    int dir = open (QFile::encodeName (cFiles->configDir).constData (),
+		    O_RDONLY);
 
-		    cfg.writeEntry (key, list);
-		}
-		break;
+    if (dir >= 0)
+    {
+	fsync (dir);
+	close (dir);
+    }
 
-	    case TypeColor:
-		{
-		    QStringList list;
-		    CCSSettingValueList l;
+    return true;
+}
 
-		    if (!ccsGetList (setting, &l) )
-			break;
+#ifdef HAVE_PROFILE_STORE
+static bool
+flushStore (ConfigFiles *cFiles)
+{
+    QSqlDatabase db = QSqlDatabase::database (cFiles->store->connection,
+					      false);
+    QSqlQuery    query (db);
 
-		    while (l)
-		    {
-			char *value;
-			
-			value = ccsColorToString (&l->data->value.asColor);
-			if (value)
-			    list.append (QString (value));
-			free (value);
+    QHash<QString, QSet<QString> >::const_iterator it;
 
-			l = l->next;
-		    }
+    if (!db.transaction ())
+	return false;
 
-		    cfg.writeEntry (key, list);
-		}
-		break;
-	    case TypeKey:
-		{
-		    QStringList list;
-		    CCSSettingValueList l;
-
-		    if (!ccsGetList (setting, &l) )
-			break;
-
-		    while (l)
-		    {
-			QString str;
-			char *val;
-			val = ccsKeyBindingToString (&l->data->value.asKey);
-
-			str = val;
-			free (val);
-			
-			list.append (str);
-			l = l->next;
-		    }
-
-		    cfg.writeEntry (key, list);
-		}
-		break;
-	    case TypeButton:
-		{
-		    QStringList list;
-		    CCSSettingValueList l;
-
-		    if (!ccsGetList (setting, &l) )
-			break;
-
-		    while (l)
-		    {
-			QString str;
-			char *val;
-			val = ccsButtonBindingToString (
-			          &l->data->value.asButton);
-
-			str = val;
-			free (val);
-			
-			list.append (str);
-			l = l->next;
-		    }
-
-		    cfg.writeEntry (key, list);
-		}
-		break;
-	    case TypeEdge:
-		{
-		    QStringList list;
-		    CCSSettingValueList l;
-
-		    if (!ccsGetList (setting, &l) )
-			break;
-
-		    while (l)
-		    {
-			QString str;
-			char *val;
-			val = ccsEdgesToString (l->data->value.asEdge);
-
-			str = val;
-			free (val);
-			
-			list.append (str);
-			l = l->next;
-		    }
-
-		    cfg.writeEntry (key, list);
-		}
-		break;
-	    case TypeBell:
-		{
-		    QList<int> list;
-		    CCSSettingValueList l;
+    query.prepare ("INSERT OR REPLACE INTO entries (grp, key, value) "
+		   "VALUES (?, ?, ?)");
 
-		    if (!ccsGetList (setting, &l) )
-			break;
+    for (it = cFiles->dirty[FileMain].constBegin ();
+	 it != cFiles->dirty[FileMain].constEnd (); it++)
+    {
+	KConfigGroup g = cFiles->main->group (it.key ());
 
-		    while (l)
-		    {
-			list.append (l->data->value.asBell);
-			l = l->next;
-		    }
+	foreach (const QString &key, it.value ())
+	{
+	    query.bindValue (0, it.key ());
+	    query.bindValue (1, key);
+	    query.bindValue (2, g.readEntry (key, QString ()).toUtf8 ());
 
-		    cfg.writeEntry (key, list);
-		}
-		break;
-	    default:
-		break;
+	    if (!query.exec ())
+	    {
+		db.rollback ();
+		return false;
 	    }
 	}
-	break;
-	
-    case TypeKey:
-	{
-	    CCSSettingKeyValue keyVal;
-
-	    if (!ccsGetKey (setting, &keyVal))
-		break;
+    }
 
-	    char *val = ccsKeyBindingToString (&keyVal);
+    if (!db.commit ())
+	return false;
 
-	    cfg.writeEntry (key, QString (val));
+    cFiles->main->markAsClean ();
 
-	    free (val);
-	}
-	break;
-    case TypeButton:
-	{
-	    CCSSettingButtonValue buttonVal;
+    return true;
+}
+#else
+static bool
+flushStore (ConfigFiles *)
+{
+    return false;
+}
+#endif
 
-	    if (!ccsGetButton (setting, &buttonVal))
-		break;
+static void
+loadBackendOptions (ConfigFiles *cFiles)
+{
+    QMutexLocker locker (&kdeDirsLock ());
 
-	    char *val = ccsButtonBindingToString (&buttonVal);
+    KConfig      options ("ccs-backend-kconfig4rc", KConfig::SimpleConfig);
+    KConfigGroup general = options.group ("General");
 
-	    cfg.writeEntry (key, QString (val));
+    QString      mode = general.readEntry ("CommitMode", QString ());
 
-	    free (val);
-	}
-	break;
-    case TypeEdge:
-	{
-	    unsigned int edges;
+    if (mode == "Transactional")
+	cFiles->commitMode = CommitTransactional;
+    else if (mode == "Journal")
+	cFiles->commitMode = CommitJournal;
+    else
+	cFiles->commitMode = CommitSequential;
 
-	    if (!ccsGetEdge (setting, &edges) )
-		break;
+    cFiles->journalLimit = general.readEntry ("JournalLimit",
+					      JOURNAL_DEFAULT_LIMIT);
+}
 
-	    char *val = ccsEdgesToString (edges);
+static void
+writeDone (CCSContext *c)
+{
+    ConfigFiles *cFiles = filesForContext (c);
 
-	    cfg.writeEntry (key, QString (val));
+    resetBindingCache ("write");
+    writeDerivedKeys (cFiles);
 
-	    free (val);
-	}
-	break;
-    case TypeBell:
-	{
-	    Bool bell;
+    bool reconfigure = !cFiles->dirty[FileKwin].isEmpty () ||
+		       cFiles->dirty[FileShortcuts].contains ("kwin");
+    bool mainChanged = !cFiles->dirty[FileMain].isEmpty ();
+    bool kdeChanged  = !cFiles->dirty[FileKwin].isEmpty () ||
+		       !cFiles->dirty[FileShortcuts].isEmpty ();
 
-	    if (!ccsGetBell (setting, &bell))
-		break;
+    /* what the store could not take, kept dirty for the next pass */
+    QHash<QString, QSet<QString> > unflushed;
+    QHash<QString, QSet<QString> > written = cFiles->dirty[FileMain];
 
-	    cfg.writeEntry (key, (bell)? true : false);
+    /* only the changed keys get written, the profile file is left alone */
+    if (cFiles->store && mainChanged)
+    {
+	if (flushStore (cFiles))
+	    recordFileHash (cFiles, FileMain);
+	else
+	{
+	    kWarning () << "Could not write" << cFiles->store->path <<
+			   ", retrying with the next write" << endl;
+	    unflushed = cFiles->dirty[FileMain];
 	}
-	break;
 
-    default:
-	kDebug () << "Not supported setting type : " << setting->type << endl;
-	break;
+	cFiles->dirty[FileMain].clear ();
     }
-}
+    else if (cFiles->commitMode == CommitJournal && mainChanged &&
+	     appendJournal (cFiles))
+	cFiles->dirty[FileMain].clear ();
 
-static Bool
-readInit (CCSContext *c)
-{
-    if (cFiles->profile != ccsGetProfile (c))
+    if (cFiles->commitMode != CommitTransactional || !commitFiles (cFiles))
     {
-	QString configName ("compizrc");
-
-	if (ccsGetProfile (c) && strlen (ccsGetProfile (c)))
+	for (int i = 0; i < N_FILES; i++)
 	{
-	    configName += ".";
-	    configName += ccsGetProfile (c);
-	    cFiles->profile = ccsGetProfile (c);
+	    if (!cFiles->dirty[i].isEmpty ())
+		syncFile (cFiles, (ConfigFileId) i);
 	}
-
-	delete cFiles->main;
-
-	QString wFile = KGlobal::dirs ()->saveLocation ("config",
-			QString::null, false) + configName;
-	createFile (wFile);
-	
-	cFiles->main = new KConfig (configName);
-	ccsRemoveFileWatch (cFiles->mainWatch);
-	cFiles->mainWatch = ccsAddFileWatch (wFile.toAscii ().constData (),
-					     TRUE, reload, (void *) c);
     }
 
-    return TRUE;
-}
+    if (kdeChanged)
+	invalidateKdeIntegration (cFiles);
 
-static void
-readDone (CCSContext *)
-{}
+    /* store readers go by the new generation, not by the entries */
+    if (mainChanged && !cFiles->store)
+	publishSnapshot (cFiles, updateSnapshot (cFiles, cFiles->main,
+						 written));
+    else if (mainChanged || kdeChanged)
+	publishSnapshot (cFiles, copySnapshot (cFiles));
 
-static Bool
-writeInit (CCSContext *c)
-{
-    if (cFiles->profile != ccsGetProfile (c))
+    /* so the events of our own writes do not reload them again */
+    for (int i = 0; i < N_FILES; i++)
     {
-	QString configName ("compizrc");
+	if (!cFiles->dirty[i].isEmpty ())
+	    recordFileHash (cFiles, (ConfigFileId) i);
 
-	if (ccsGetProfile (c) && strlen (ccsGetProfile (c)))
-	{
-	    configName += ".";
-	    configName += ccsGetProfile (c);
-	    cFiles->profile = ccsGetProfile (c);
-	}
+	cFiles->dirty[i].clear ();
+    }
 
-	delete cFiles->main;
+    cFiles->dirty[FileMain] = unflushed;
 
-	QString wFile = KGlobal::dirs ()->saveLocation ("config",
-			QString::null, false) + configName;
-	
-	createFile (wFile);
-	
-	cFiles->main = new KConfig (configName);
-	ccsRemoveFileWatch (cFiles->mainWatch);
-	cFiles->mainWatch = ccsAddFileWatch (wFile.toAscii ().constData (),
-					     TRUE, reload, (void *) c);
-    }
+    if (mainChanged)
+	recordJournalHash (cFiles);
 
-    ccsDisableFileWatch (cFiles->mainWatch);
-    ccsDisableFileWatch (cFiles->kwinWatch);
-    ccsDisableFileWatch (cFiles->shortcutWatch);
+    if (reconfigure)
+    {
+	org::kde::KWin kwin ("org.kde.kwin", "/KWin", 
+			     QDBusConnection::sessionBus());
+        kwin.reconfigure();
+    }
 
-    return TRUE;
+    setWatchesEnabled (cFiles, true);
 }
 
-static void
-writeDone (CCSContext *)
+/* only the groups holding keys we integrate with get loaded */
+static KdeFile *
+openKdeFile (ConfigFileId file)
 {
-    cFiles->main->sync();
+    KdeFile *kf = new KdeFile;
 
-    if (cFiles->modified)
+    kf->name = (file == FileKwin) ? "kwinrc" : "kglobalshortcutsrc";
+
+    for (unsigned int i = 0; i < N_SOPTIONS; i++)
     {
-	cFiles->kwin->sync();
-	cFiles->shortcuts->sync();
+	if ((specialOptions[i].type == OptionKey) == (file == FileShortcuts))
+	    kf->groups.insert (specialOptions[i].groupName);
+    }
 
-	org::kde::KWin kwin ("org.kde.kwin", "/KWin", 
-			     QDBusConnection::sessionBus());
-        kwin.reconfigure();
+    /* the switcher keys go to the shortcuts file, alongside TabBox
+       settings in kwinrc */
+    if (file == FileKwin)
+	kf->groups.insert ("TabBox");
+    else
+	kf->groups.insert ("Windows");
 
-	cFiles->modified = false;
-    }
+    loadKdeFile (kf);
 
-    ccsEnableFileWatch (cFiles->mainWatch);
-    ccsEnableFileWatch (cFiles->kwinWatch);
-    ccsEnableFileWatch (cFiles->shortcutWatch);
+    return kf;
 }
 
 static Bool
 init (CCSContext *c)
 {
-    QString configName ("compizrc");
+    QString     configName ("compizrc");
+    ConfigFiles *cFiles;
 
-    cFiles = new ConfigFiles();
-    
-    if (ccsGetProfile (c) && strlen (ccsGetProfile (c)))
-    {
-	configName += ".";
-	configName += ccsGetProfile (c);
-	cFiles->profile = ccsGetProfile (c);
-    }
+    initComponentData ();
 
-    QString wFile = KGlobal::dirs ()->saveLocation ("config",
-		    QString::null, false) + configName;
+    cFiles = new ConfigFiles ();
 
-    createFile (wFile);
+    cFiles->context   = c;
 
-    cFiles->main      = new KConfig (configName);
-    cFiles->kwin      = new KConfig ("kwinrc");
-    cFiles->shortcuts = new KConfig ("kglobalshortcutsrc");
+    kdeDirsLock ().lock ();
+    cFiles->configDir = KGlobal::dirs ()->saveLocation ("config",
+							QString::null, false);
+    kdeDirsLock ().unlock ();
 
+    loadBackendOptions (cFiles);
 
-    cFiles->mainWatch = ccsAddFileWatch (wFile.toAscii ().constData (), TRUE,
-					 reload, (void *) c);
+    cFiles->profile = ccsGetProfile (c);
 
-    wFile = KGlobal::dirs ()->saveLocation ("config", QString::null, false) + 
-		"kwinrc";
-    cFiles->kwinWatch = ccsAddFileWatch (wFile.toAscii ().constData (),
-					 TRUE, reload, (void *) c);
+    if (!cFiles->profile.isEmpty ())
+	configName += "." + cFiles->profile;
 
-    wFile = KGlobal::dirs ()->saveLocation ("config", QString::null, false) + 
-		"kglobalshortcutsrc";
-    cFiles->shortcutWatch = ccsAddFileWatch (wFile.toAscii ().constData (),
-					     TRUE, reload, (void *) c);
+    openMain (cFiles, configName);
+
+    cFiles->kwin      = openKdeFile (FileKwin);
+    cFiles->shortcuts = openKdeFile (FileShortcuts);
+
+    loadJournal (cFiles);
+
+    for (int i = 0; i < N_FILES; i++)
+	recordFileHash (cFiles, (ConfigFileId) i);
+
+    publishSnapshot (cFiles, loadSnapshot (cFiles));
+
+    watchConfigDir (cFiles);
+    watchJournal (cFiles);
+    watchLayers (cFiles);
+
+    for (CCSPluginList p = c->plugins; p; p = p->next)
+	cFiles->settings += ccsSettingListLength (p->data->settings);
+
+    internCacheSettings ().fetchAndAddOrdered (cFiles->settings);
+
+    QMutexLocker locker (&contextFilesLock ());
+
+    setFilesForContext (c, cFiles);
 
     return TRUE;
 }
 
 static Bool
-fini (CCSContext *)
+fini (CCSContext *c)
 {
+    ConfigFiles *cFiles;
+
+    {
+	QMutexLocker locker (&contextFilesLock ());
+
+	cFiles = filesForContext (c);
+
+	if (cFiles)
+	    setFilesForContext (c, NULL);
+    }
+
     if (cFiles)
     {
-	ccsRemoveFileWatch (cFiles->mainWatch);
-	ccsRemoveFileWatch (cFiles->kwinWatch);
-	ccsRemoveFileWatch (cFiles->shortcutWatch);
+	internCacheSettings ().fetchAndAddOrdered (-cFiles->settings);
+
+	fileWatchLock ().lock ();
+	ccsRemoveFileWatch (cFiles->dirWatch);
+	fileWatchLock ().unlock ();
+
+	if (cFiles->inotifyFd >= 0)
+	    close (cFiles->inotifyFd);
+
+	cFiles->compaction.waitForFinished ();
+
+	QMutexLocker locker (&kdeDirsLock ());
 	
 	if (cFiles->main)
 	    delete cFiles->main;
@@ -1810,12 +4709,14 @@ fini (CCSContext *)
 	if (cFiles->shortcuts)
 	    delete cFiles->shortcuts;
 
+	releaseStore (cFiles->store);
+	invalidateKdeIntegration (cFiles);
+
+	releaseSnapshot (cFiles->snapshot.fetchAndStoreOrdered (NULL));
 
 	delete cFiles;
     }
 
-    cFiles = NULL;
-
     return TRUE;
 }
 
@@ -1823,7 +4724,10 @@ static Bool
 deleteProfile (CCSContext *,
 	       char       *profile)
 {
-    QString file (KGlobal::dirs()->saveLocation ("config",
+    initComponentData ();
+
+    QMutexLocker locker (&kdeDirsLock ());
+    QString      file (KGlobal::dirs()->saveLocation ("config",
 		  QString::null, false) );
     file += "compizrc";
 
@@ -1833,10 +4737,19 @@ deleteProfile (CCSContext *,
 	file += profile;
     }
 
+    unlinkLayer (KGlobal::dirs()->saveLocation ("config", QString::null,
+						false), QString (profile));
+
+    QFile::remove (file + JOURNAL_SUFFIX);
+    QFile::remove (pendingPath (file + JOURNAL_SUFFIX));
+
+    bool removed = QFile::exists (file + STORE_SUFFIX) &&
+		   QFile::remove (file + STORE_SUFFIX);
+
     if (QFile::exists (file) )
 	return QFile::remove (file);
 
-    return FALSE;
+    return (removed) ? TRUE : FALSE;
 }
 
 static CCSBackendVTable kconfigVTable =
@@ -1867,8 +4780,24 @@ extern "C"
     KDE_EXPORT CCSBackendVTable *
     getBackendInfo (void)
     {
-	KComponentData componentData ("ccs-backend-kconfig4");
 	return &kconfigVTable;
     }
 
+    /* used by the reload benchmark in bench/ */
+    KDE_EXPORT void
+    getBackendReloadStats (CCSContext         *context,
+			   unsigned int       *reloads,
+			   unsigned int       *skipped,
+			   unsigned long long *usec)
+    {
+	ConfigFiles *cFiles = filesForContext (context);
+
+	if (!cFiles)
+	    return;
+
+	*reloads = cFiles->reloads;
+	*skipped = cFiles->skippedReloads;
+	*usec    = cFiles->reloadTime;
+    }
+
 }
@@ -0,0 +1,435 @@
+/*
+ *  Color conversion test for the KDE4 libcompizconfig backend
+ *
+ *  Checks the backend's "#rrggbbaa" fast path against libcompizconfig:
+ *  colorToHex () against ccsColorToString () for every value of every
+ *  channel, stringToColor () against ccsStringToColor () for every pair
+ *  of bytes in every channel's digits, and hexToColor (colorToHex ())
+ *  round trips for every 32 bit color. The list conversions are checked
+ *  against the single color ones. Also times both sides on the same
+ *  conversions, and the SSE2 list conversions against the scalar ones.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include <QVarLengthArray>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+extern "C"
+{
+#include <ccs.h>
+}
+
+#include "color_convert.h"
+
+static quint64
+timeUsec ()
+{
+    struct timeval tv;
+
+    gettimeofday (&tv, NULL);
+
+    return (quint64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* other channels hold these while one runs through all its values */
+static const unsigned short background[4] = { 0x1234, 0xabcd, 0x0000, 0xffff };
+
+typedef struct _Counts
+{
+    unsigned long long checked;
+    unsigned long long failed;
+}
+Counts;
+
+static void
+fail (Counts     &counts,
+      const char *what,
+      const char *input,
+      const char *own,
+      const char *ccs)
+{
+    if (counts.failed++ < 16)
+	printf ("%s: \"%s\" gives \"%s\", libcompizconfig \"%s\"\n",
+		what, input, own, ccs);
+}
+
+static QByteArray
+colorString (const CCSSettingColorValue &color)
+{
+    QByteArray str;
+
+    for (int i = 0; i < 4; i++)
+	str += QByteArray::number (color.array[i], 16).rightJustified (4, '0');
+
+    return str;
+}
+
+static void
+checkEncode (Counts &counts)
+{
+    for (int channel = 0; channel < 4; channel++)
+    {
+	for (int value = 0; value <= 0xffff; value++)
+	{
+	    CCSSettingColorValue color;
+	    char                 hex[10];
+
+	    memcpy (color.array, background, sizeof (color.array));
+	    color.array[channel] = value;
+
+	    hex[0] = '#';
+	    colorToHex (&color, hex + 1);
+	    hex[9] = '\0';
+
+	    char *ccs = ccsColorToString (&color);
+
+	    counts.checked++;
+
+	    if (!ccs || strcmp (hex, ccs))
+		fail (counts, "encode", colorString (color).constData (),
+		      hex, (ccs) ? ccs : "(null)");
+
+	    free (ccs);
+	}
+    }
+}
+
+static void
+checkDecode (Counts &counts)
+{
+    for (int channel = 0; channel < 4; channel++)
+    {
+	for (int pair = 0; pair <= 0xffff; pair++)
+	{
+	    char                 str[10] = "#12abCD0f";
+	    CCSSettingColorValue own, ccs;
+	    Bool                 ownOk, ccsOk;
+
+	    str[1 + channel * 2] = pair >> 8;
+	    str[2 + channel * 2] = pair & 0xff;
+
+	    /* a NUL among the digits ends the entry, like it would in
+	       a file */
+	    QByteArray entry (str, strlen (str));
+
+	    memset (&own, 0, sizeof (own));
+	    memset (&ccs, 0, sizeof (ccs));
+
+	    ownOk = stringToColor (entry, &own);
+	    ccsOk = ccsStringToColor (entry.constData (), &ccs);
+
+	    counts.checked++;
+
+	    if (!ownOk != !ccsOk ||
+		(ownOk && memcmp (own.array, ccs.array, sizeof (own.array))))
+		fail (counts, "decode",
+		      entry.toPercentEncoding ().constData (),
+		      (ownOk) ? colorString (own).constData () : "(invalid)",
+		      (ccsOk) ? colorString (ccs).constData () : "(invalid)");
+	}
+    }
+}
+
+/* every color the eight digits can express, no libcompizconfig calls */
+static void
+checkRoundTrip (Counts &counts,
+		bool   quick)
+{
+    quint32 step = (quick) ? 65521 : 1;
+
+    for (quint64 value = 0; value <= 0xffffffffULL; value += step)
+    {
+	CCSSettingColorValue color, back;
+	char                 hex[8];
+
+	for (int i = 0; i < 4; i++)
+	    color.array[i] = ((value >> (24 - i * 8)) & 0xff) * 0x101;
+
+	colorToHex (&color, hex);
+
+	counts.checked++;
+
+	if (!hexToColor (hex, &back) ||
+	    memcmp (color.array, back.array, sizeof (color.array)))
+	    fail (counts, "round trip", colorString (color).constData (),
+		  QByteArray (hex, 8).constData (),
+		  colorString (color).constData ());
+    }
+}
+
+/* the same colors through both sides, one color per call like the
+   codecs do */
+static void
+timeConversions ()
+{
+    QList<QByteArray>             strings;
+    QVector<CCSSettingColorValue> colors (0x10000);
+    CCSSettingColorValue          color;
+    quint64                       t, own, ccs;
+
+    for (int i = 0; i < colors.size (); i++)
+    {
+	for (int j = 0; j < 4; j++)
+	    colors[i].array[j] = (i * (j + 1) * 0x9e37) & 0xffff;
+
+	char *str = ccsColorToString (&colors[i]);
+
+	strings.append (str);
+	free (str);
+    }
+
+    t = timeUsec ();
+    foreach (const CCSSettingColorValue &c, colors)
+    {
+	char hex[8];
+
+	colorToHex (&c, hex);
+	asm volatile ("" : : "r" (hex) : "memory");
+    }
+    own = timeUsec () - t;
+
+    t = timeUsec ();
+    for (int i = 0; i < colors.size (); i++)
+	free (ccsColorToString (&colors[i]));
+    ccs = timeUsec () - t;
+
+    printf ("encode time         %.2f ms, libcompizconfig %.2f ms\n",
+	    own / 1000.0, ccs / 1000.0);
+
+    t = timeUsec ();
+    foreach (const QByteArray &str, strings)
+    {
+	stringToColor (str, &color);
+	asm volatile ("" : : "r" (&color) : "memory");
+    }
+    own = timeUsec () - t;
+
+    t = timeUsec ();
+    foreach (const QByteArray &str, strings)
+	ccsStringToColor (str.constData (), &color);
+    ccs = timeUsec () - t;
+
+    printf ("decode time         %.2f ms, libcompizconfig %.2f ms\n",
+	    own / 1000.0, ccs / 1000.0);
+}
+
+/* the hex digits of n test colors, every seventh one broken or in
+   another format, the way the backend hands a list to hexToColors () */
+static void
+batchInput (QVector<CCSSettingColorValue> &colors,
+	    QByteArray                    &digits,
+	    QVector<const char *>         &hex)
+{
+    static const char broken[] = "12ab#D0f";
+
+    digits.resize (colors.size () * 8);
+    hex.resize (colors.size ());
+
+    for (int i = 0; i < colors.size (); i++)
+    {
+	for (int j = 0; j < 4; j++)
+	    colors[i].array[j] = (i * (j + 1) * 0x9e37) & 0xffff;
+
+	colorToHex (&colors[i], digits.data () + i * 8);
+	hex[i] = digits.constData () + i * 8;
+
+	if (i % 7 == 3)
+	    memcpy (digits.data () + i * 8, broken, 8);
+	else if (i % 7 == 5)
+	    hex[i] = NULL;
+    }
+}
+
+/* the list conversions against the single color ones, for list lengths
+   that leave an odd element over and those that do not */
+static void
+checkBatch (Counts &counts)
+{
+    for (int n = 0; n <= 67; n++)
+    {
+	QVector<CCSSettingColorValue> colors (n), batch (n);
+	QVector<const char *>         hex;
+	QByteArray                    digits, encoded (n * 8, '\0');
+	QVarLengthArray<bool, 64>     valid (n);
+
+	batchInput (colors, digits, hex);
+	hexToColors (hex.constData (), batch.data (), valid.data (), n);
+
+	for (int i = 0; i < n; i++)
+	{
+	    CCSSettingColorValue single;
+	    bool                 ok = hex[i] && hexToColor (hex[i], &single);
+
+	    counts.checked++;
+
+	    if (ok != valid[i] ||
+		(ok && memcmp (single.array, batch[i].array,
+			       sizeof (single.array))))
+		fail (counts, "list decode",
+		      (hex[i]) ? QByteArray (hex[i], 8).constData () : "(none)",
+		      (valid[i]) ? colorString (batch[i]).constData () :
+				   "(invalid)",
+		      (ok) ? colorString (single).constData () : "(invalid)");
+	}
+
+	colorsToHex (colors.constData (), encoded.data (), n);
+
+	for (int i = 0; i < n; i++)
+	{
+	    char single[8];
+
+	    colorToHex (&colors[i], single);
+	    counts.checked++;
+
+	    if (memcmp (single, encoded.constData () + i * 8, 8))
+		fail (counts, "list encode",
+		      colorString (colors[i]).constData (),
+		      encoded.mid (i * 8, 8).constData (),
+		      QByteArray (single, 8).constData ());
+	}
+    }
+}
+
+/* the SSE2 list conversions against the scalar ones they fall back to,
+   on lists of the given length */
+static void
+timeBatch (int length)
+{
+    QVector<CCSSettingColorValue> colors (0x10000), out (0x10000);
+    QVector<const char *>         hex;
+    QByteArray                    digits, encoded (colors.size () * 8, '\0');
+    QVarLengthArray<bool, 64>     valid (colors.size ());
+    quint64                       t, scalar;
+
+    batchInput (colors, digits, hex);
+
+    t = timeUsec ();
+    for (int i = 0; i < colors.size (); i += length)
+	hexToColorsScalar (hex.constData () + i, out.data () + i,
+			   valid.data () + i, qMin (length, colors.size () - i));
+    scalar = timeUsec () - t;
+
+#ifdef __SSE2__
+    quint64 sse2;
+
+    t = timeUsec ();
+    for (int i = 0; i < colors.size (); i += length)
+	hexToColorsSse2 (hex.constData () + i, out.data () + i,
+			 valid.data () + i, qMin (length, colors.size () - i));
+    sse2 = timeUsec () - t;
+
+    printf ("list decode time    %.2f ms SSE2, %.2f ms scalar\n",
+	    sse2 / 1000.0, scalar / 1000.0);
+#else
+    printf ("list decode time    %.2f ms scalar, no SSE2\n", scalar / 1000.0);
+#endif
+
+    t = timeUsec ();
+    for (int i = 0; i < colors.size (); i += length)
+	colorsToHexScalar (colors.constData () + i, encoded.data () + i * 8,
+			   qMin (length, colors.size () - i));
+    scalar = timeUsec () - t;
+
+#ifdef __SSE2__
+    t = timeUsec ();
+    for (int i = 0; i < colors.size (); i += length)
+	colorsToHexSse2 (colors.constData () + i, encoded.data () + i * 8,
+			 qMin (length, colors.size () - i));
+    sse2 = timeUsec () - t;
+
+    printf ("list encode time    %.2f ms SSE2, %.2f ms scalar\n",
+	    sse2 / 1000.0, scalar / 1000.0);
+#else
+    printf ("list encode time    %.2f ms scalar, no SSE2\n", scalar / 1000.0);
+#endif
+
+    asm volatile ("" : : "r" (out.constData ()), "r" (encoded.constData ())
+		  : "memory");
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr, "usage: %s [-q] [-l list length]\n", name);
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    bool quick  = false;
+    int  length = 32;
+    int  opt;
+
+    while ((opt = getopt (argc, argv, "ql:h")) != -1)
+    {
+	switch (opt)
+	{
+	case 'q':
+	    quick = true;
+	    break;
+	case 'l':
+	    length = atoi (optarg);
+	    break;
+	default:
+	    usage (argv[0]);
+	    return 1;
+	}
+    }
+
+    if (length <= 0)
+    {
+	usage (argv[0]);
+	return 1;
+    }
+
+    Counts encode, decode, roundTrip, batch;
+
+    memset (&encode, 0, sizeof (Counts));
+    memset (&decode, 0, sizeof (Counts));
+    memset (&roundTrip, 0, sizeof (Counts));
+    memset (&batch, 0, sizeof (Counts));
+
+    checkEncode (encode);
+    checkDecode (decode);
+    checkRoundTrip (roundTrip, quick);
+    checkBatch (batch);
+
+    printf ("encode              %llu checked, %llu failed\n",
+	    encode.checked, encode.failed);
+    printf ("decode              %llu checked, %llu failed\n",
+	    decode.checked, decode.failed);
+    printf ("round trip          %llu checked, %llu failed\n",
+	    roundTrip.checked, roundTrip.failed);
+    printf ("lists               %llu checked, %llu failed\n",
+	    batch.checked, batch.failed);
+
+    timeConversions ();
+    printf ("list length         %d\n", length);
+    timeBatch (length);
+
+    return (encode.failed || decode.failed || roundTrip.failed ||
+	    batch.failed) ? 1 : 0;
+}
@@ -0,0 +1,378 @@
+/*
+ *  Differential test of the INI parser of the KDE4 libcompizconfig backend
+ *
+ *  Feeds a corpus of hand written files and random ones to KConfig and to
+ *  the backend's own parseIni (), with and without a group filter, and
+ *  compares the entries both found. parseIni () may give up and leave a
+ *  file to KConfig, but whatever it does return has to match KConfig.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QDir>
+#include <QMap>
+#include <QSet>
+
+#include <KConfig>
+#include <KConfigGroup>
+#include <KComponentData>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ini_file.h"
+
+static const char *corpus[] =
+{
+    /* plain groups and entries */
+    "[Windows]\nFocusPolicy=ClickToFocus\nBorderSnapZone=10\n",
+    "[Windows]\n  Key  =  value  \n\n# comment\n[kwin]\nA=1\n",
+    "[Windows]\nKey=\nOther=x\n",
+    "[Windows]\nKey=1\nKey=2\n[kwin]\nA=1\n[Windows]\nKey=3\n",
+    "[A B]\nKey Two=two words\n",
+    "[Windows]\nnoequals\nKey=v\n",
+    "[Windows]\nKey==v\nK=[x]\n",
+
+    /* CRLF */
+    "[Windows]\r\nFocusPolicy=ClickToFocus\r\nBorderSnapZone=10\r\n",
+    "[Windows]\r\nKey=a,b\\,c\r\n\r\n[kwin]\r\nA=1",
+
+    /* escapes */
+    "[Windows]\nKey=\\sleading and trailing\\s\n",
+    "[Windows]\nKey=tab\\there\\nnewline\\rreturn\n",
+    "[Windows]\nKey=back\\\\slash\nHex=\\x41\\x7e\n",
+    "[Windows]\nK\\x3dy=escaped key\n",
+    "[Windows]\nKey=unknown \\q escape\n",
+    "[Windows]\nKey=short \\x4\n",
+    "[Windows]\nKey=trailing \\\n",
+    "[\\x57indows]\nKey=escaped group\n",
+
+    /* lists */
+    "[kwin]\nWindow Close=Alt+F4,Alt+F4,Close Window\n",
+    "[kwin]\nList=a\\,b,c\\;d,e\n",
+    "[kwin]\nList=\\\\0\nEmpty=,,\n",
+
+    /* $ flags and kiosk markers */
+    "[Windows]\nKey[$i]=locked\nOther=free\n",
+    "[Windows]\nPath[$e]=$HOME/x\n",
+    "[Windows][$i]\nKey=locked group\n",
+    "[$i]\n[Windows]\nKey=locked file\n",
+    "[kwin]\nA=1\n[Windows][$i]\nKey=locked\n",
+    "[Other][$i]\nKey=locked elsewhere\n[Windows]\nKey=free\n",
+
+    /* locales, nested and odd groups */
+    "[Windows]\nName=plain\nName[de]=deutsch\n",
+    "[Windows][Sub]\nKey=nested\n",
+    "[]\nKey=empty group\n",
+    "[Windows\nKey=unterminated\n",
+
+    /* the default group */
+    "Key=default group\n[Windows]\nKey=v\n",
+    "Key=default group only\n",
+
+    /* non-ASCII */
+    "[Windows]\nKey=gr\xc3\xbc\xc3\x9f\n",
+    "[Gr\xc3\xbcppe]\nSch\xc3\xbcssel=Wert\n",
+
+    NULL
+};
+
+static const char *groupTokens[] =
+{
+    "[Windows]", "[kwin]", "[A B]", "[Other]", "[$i]", "[Windows][$i]",
+    "[Windows][Sub]", "[\\x57indows]", "[]", "[Windows", "[Gr\xc3\xbcppe]"
+};
+
+static const char *keyTokens[] =
+{
+    "Key", "Key Two", " Key ", "Key[$i]", "Key[$e]", "Key[de]", "K\\x3dy",
+    "K\\sy", "\xc3\xa9", ""
+};
+
+static const char *valueTokens[] =
+{
+    "", "v", " v ", "a,b,c", "a\\,b", "a\\;b", "\\s", "\\t\\n\\r", "\\\\",
+    "\\x41", "\\q", "\\x4", "$HOME", "\xc3\xbc", "=", "[x]", "\\", "\\\\0"
+};
+
+static const char *separatorTokens[] = { "=", " = ", "=\t", "\t=" };
+
+#define N_TOKENS(t) (sizeof (t) / sizeof (t[0]))
+
+static const char *
+pick (const char   **tokens,
+      unsigned int n)
+{
+    return tokens[rand () % n];
+}
+
+static QByteArray
+randomFile ()
+{
+    QByteArray data;
+    int        lines = 1 + rand () % 12;
+    const char *eol = (rand () % 4) ? "\n" : "\r\n";
+
+    for (int i = 0; i < lines; i++)
+    {
+	switch (rand () % 8)
+	{
+	case 0:
+	case 1:
+	    data += pick (groupTokens, N_TOKENS (groupTokens));
+	    break;
+	case 2:
+	    data += "# comment";
+	    break;
+	case 3:
+	    break;
+	case 4:
+	    data += pick (keyTokens, N_TOKENS (keyTokens));
+	    break;
+	default:
+	    data += pick (keyTokens, N_TOKENS (keyTokens));
+	    data += pick (separatorTokens, N_TOKENS (separatorTokens));
+	    data += pick (valueTokens, N_TOKENS (valueTokens));
+	    break;
+	}
+
+	/* the last line may go without an end of line */
+	if (i < lines - 1 || rand () % 2)
+	    data += eol;
+    }
+
+    return data;
+}
+
+static QByteArray
+printable (const QByteArray &data)
+{
+    QByteArray out;
+
+    for (int i = 0; i < data.size (); i++)
+    {
+	unsigned char c = data[i];
+
+	if (c == '\n')
+	    out += "\\n\n";
+	else if (c == '\r')
+	    out += "\\r";
+	else if (c < 0x20 || c >= 0x7f)
+	    out += "\\x" + QByteArray::number (c, 16);
+	else
+	    out += c;
+    }
+
+    return out;
+}
+
+static void
+printEntries (const char           *title,
+	      const ProfileEntries &entries)
+{
+    ProfileEntries::const_iterator g;
+    GroupEntries::const_iterator   e;
+
+    printf ("  %s:\n", title);
+
+    for (g = entries.constBegin (); g != entries.constEnd (); g++)
+	for (e = g->constBegin (); e != g->constEnd (); e++)
+	    printf ("    [%s] %s = \"%s\"\n", g.key ().toUtf8 ().constData (),
+		    e.key ().toUtf8 ().constData (),
+		    printable (e.value ()).constData ());
+}
+
+/* what the backend gets from KConfig for a profile it cannot parse */
+static ProfileEntries
+kconfigEntries (const QString &path)
+{
+    KConfig        config (path, KConfig::SimpleConfig);
+    ProfileEntries entries;
+
+    foreach (const QString &group, config.groupList ())
+    {
+	QMap<QString, QString>                 map =
+	    config.group (group).entryMap ();
+	QMap<QString, QString>::const_iterator it;
+	GroupEntries                           &values = entries[group];
+
+	for (it = map.constBegin (); it != map.constEnd (); it++)
+	    values.insert (it.key (), it.value ().toUtf8 ());
+    }
+
+    return entries;
+}
+
+/* empty groups are no difference, KConfig does not list them */
+static ProfileEntries
+withoutEmptyGroups (const ProfileEntries &entries)
+{
+    ProfileEntries                 out;
+    ProfileEntries::const_iterator g;
+
+    for (g = entries.constBegin (); g != entries.constEnd (); g++)
+	if (!g->isEmpty ())
+	    out.insert (g.key (), g.value ());
+
+    return out;
+}
+
+typedef struct _Counts
+{
+    unsigned int files;
+    unsigned int parsed;
+    unsigned int filteredParsed;
+    unsigned int mismatches;
+}
+Counts;
+
+static void
+check (const QString       &path,
+       const QByteArray    &data,
+       const QSet<QString> &wanted,
+       bool                verbose,
+       Counts              &counts)
+{
+    QFile f (path);
+
+    if (!f.open (QIODevice::WriteOnly | QIODevice::Truncate))
+	return;
+
+    f.write (data);
+    f.close ();
+
+    counts.files++;
+
+    ProfileEntries reference = withoutEmptyGroups (kconfigEntries (path));
+
+    ProfileEntries filteredReference;
+
+    foreach (const QString &group, wanted)
+	if (reference.contains (group))
+	    filteredReference.insert (group, reference.value (group));
+
+    ProfileEntries all, filtered;
+    bool           parsed = parseIni (data.constData (), data.size (),
+				      NULL, all);
+    bool           filteredParsed = parseIni (data.constData (), data.size (),
+					      &wanted, filtered);
+
+    all      = withoutEmptyGroups (all);
+    filtered = withoutEmptyGroups (filtered);
+
+    counts.parsed         += parsed;
+    counts.filteredParsed += filteredParsed;
+
+    bool mismatch = (parsed && all != reference) ||
+		    (filteredParsed && filtered != filteredReference);
+
+    if (!mismatch && !verbose)
+	return;
+
+    if (mismatch)
+	counts.mismatches++;
+
+    printf ("%s:\n%s\n", (mismatch) ? "MISMATCH" : "file",
+	    printable (data).constData ());
+    printEntries ("KConfig", reference);
+
+    if (parsed)
+	printEntries ("parseIni", all);
+    if (filteredParsed)
+	printEntries ("parseIni, filtered", filtered);
+
+    printf ("\n");
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr, "usage: %s [-n random files] [-s seed] [-v]\n", name);
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    int          iterations = 10000;
+    unsigned int seed = time (NULL);
+    bool         verbose = false;
+    int          opt;
+
+    while ((opt = getopt (argc, argv, "n:s:vh")) != -1)
+    {
+	switch (opt)
+	{
+	case 'n':
+	    iterations = atoi (optarg);
+	    break;
+	case 's':
+	    seed = strtoul (optarg, NULL, 10);
+	    break;
+	case 'v':
+	    verbose = true;
+	    break;
+	default:
+	    usage (argv[0]);
+	    return 1;
+	}
+    }
+
+    char home[] = "/tmp/ini-diff-XXXXXX";
+
+    if (!mkdtemp (home))
+    {
+	perror ("mkdtemp");
+	return 1;
+    }
+
+    setenv ("KDEHOME", home, 1);
+
+    QCoreApplication app (argc, argv);
+    KComponentData   componentData ("ini-diff");
+
+    QString       path = QString (home) + "/test.ini";
+    QSet<QString> wanted;
+    Counts        counts;
+
+    memset (&counts, 0, sizeof (counts));
+
+    wanted << "Windows" << "kwin" << "A B";
+
+    for (int i = 0; corpus[i]; i++)
+	check (path, corpus[i], wanted, verbose, counts);
+
+    srand (seed);
+
+    for (int i = 0; i < iterations; i++)
+	check (path, randomFile (), wanted, verbose, counts);
+
+    QFile::remove (path);
+    QDir ().rmdir (home);
+
+    printf ("seed                %u\n", seed);
+    printf ("files               %u\n", counts.files);
+    printf ("parsed              %u\n", counts.parsed);
+    printf ("parsed, filtered    %u\n", counts.filteredParsed);
+    printf ("mismatches          %u\n", counts.mismatches);
+
+    return (counts.mismatches) ? 1 : 0;
+}